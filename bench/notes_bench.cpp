@@ -0,0 +1,217 @@
+// Headless benchmark for the markup parser. Builds without SDL or ImGui.
+//
+//   notes_bench [--json] [--max-size BYTES] [--runs N]
+//
+// Documents are generated in the style of EXAMPLE.txt at 1 KiB, 10 KiB, ...
+// up to --max-size (default 100 MiB).
+#include "markup.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <variant>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+static std::atomic<size_t> alloc_count{0};
+static std::atomic<size_t> alloc_bytes{0};
+
+void *operator new(size_t sz) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(sz, std::memory_order_relaxed);
+  if (void *p = std::malloc(sz ? sz : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+static size_t peak_rss() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return pmc.PeakWorkingSetSize;
+  return 0;
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss;
+#else
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+class DocGenerator {
+  std::mt19937 rng{1234};
+  std::vector<std::string> words{"note",  "meeting", "release", "parser",
+                                 "table", "image",   "review",  "latency",
+                                 "ünï",   "çödé",    "frame",   "buffer"};
+
+  size_t pick(size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+  }
+
+  std::string word() { return words[pick(words.size())]; }
+
+  // Inline run with formatting nested up to `depth` levels
+  void inline_text(std::string &out, int depth) {
+    static const char *marks[] = {"**", "/", "*", "~~"};
+    size_t n = 3 + pick(8);
+    for (size_t i = 0; i < n; ++i) {
+      if (depth > 0 && pick(4) == 0) {
+        const char *m = marks[pick(4)];
+        out += m;
+        inline_text(out, depth - 1);
+        out += m;
+      } else {
+        out += word();
+      }
+      out += ' ';
+    }
+  }
+
+public:
+  std::string generate(size_t size) {
+    std::string out{};
+    out.reserve(size + 1024);
+    while (out.size() < size) {
+      switch (pick(8)) {
+      case 0:
+        out += std::string(1 + pick(3), '#');
+        out += ' ';
+        inline_text(out, 1);
+        out += '\n';
+        break;
+      case 1:
+        for (size_t i = 0, n = 2 + pick(6); i < n; ++i) {
+          out += "• ";
+          inline_text(out, 2);
+          out += '\n';
+        }
+        break;
+      case 2: {
+        size_t cols = 2 + pick(4);
+        for (size_t r = 0, n = 2 + pick(30); r < n; ++r) {
+          out += '|';
+          for (size_t c = 0; c < cols; ++c) {
+            out += word();
+            out += '|';
+          }
+          out += '\n';
+        }
+      } break;
+      case 3:
+        for (size_t i = 0, n = 5 + pick(40); i < n; ++i) {
+          out += "\tfor (int i = 0; i < n; ++i) { sum += v[i] * 2; }\n";
+        }
+        break;
+      case 4:
+        for (size_t i = 0, n = 1 + pick(4); i < n; ++i)
+          out += "[ok.png]";
+        out += '\n';
+        break;
+      default:
+        inline_text(out, 4);
+        out += "\\* \\/ escaped\n";
+        break;
+      }
+    }
+    out.resize(size);
+    return out;
+  }
+};
+
+struct Result {
+  size_t bytes{0};
+  size_t tokens{0};
+  double seconds{0};
+  double allocs_per_mb{0};
+  size_t peak_rss{0};
+};
+
+static Result run(const std::string &doc, int runs) {
+  Result res{};
+  res.bytes = doc.size();
+  double best{1e30};
+  size_t allocs{0};
+  // Reused across runs like the editor's buffer is across reparses
+  Tokens tokens{};
+  for (int i = 0; i < runs; ++i) {
+    Parser parser{doc, tokens};
+    size_t before = alloc_count.load();
+    auto start = std::chrono::steady_clock::now();
+    parser.parse_all();
+    auto end = std::chrono::steady_clock::now();
+    allocs = alloc_count.load() - before;
+    res.tokens = tokens.size();
+    best = std::min(best, std::chrono::duration<double>(end - start).count());
+  }
+  res.seconds = best;
+  res.allocs_per_mb = allocs / (doc.size() / (1024.0 * 1024.0));
+  res.peak_rss = peak_rss();
+  return res;
+}
+
+int main(int argc, char *argv[]) {
+  bool json{false};
+  size_t max_size{100ull << 20};
+  int runs{3};
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "--json")) {
+      json = true;
+    } else if (!std::strcmp(argv[i], "--max-size") && i + 1 < argc) {
+      max_size = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--runs") && i + 1 < argc) {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--json] [--max-size BYTES] [--runs N]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  DocGenerator gen{};
+  std::vector<Result> results{};
+  for (size_t size = 1024; size <= max_size; size *= 10) {
+    std::string doc{gen.generate(size)};
+    // Large documents get a single run to keep the whole sweep short
+    results.push_back(run(doc, size > (8u << 20) ? 1 : runs));
+    if (!json) {
+      const Result &r = results.back();
+      std::printf("%10zu B  %9zu tok  %8.2f MB/s  %10.0f tok/s  "
+                  "%8.0f alloc/MB  peak %zu MB\n",
+                  r.bytes, r.tokens, r.bytes / r.seconds / (1 << 20),
+                  r.tokens / r.seconds, r.allocs_per_mb, r.peak_rss >> 20);
+    }
+  }
+
+  if (json) {
+    std::printf("{\"benchmark\":\"parse_all\",\"results\":[");
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result &r = results[i];
+      std::printf("%s{\"bytes\":%zu,\"tokens\":%zu,\"seconds\":%.9f,"
+                  "\"bytes_per_s\":%.1f,\"tokens_per_s\":%.1f,"
+                  "\"allocs_per_mb\":%.1f,\"peak_rss\":%zu}",
+                  i ? "," : "", r.bytes, r.tokens, r.seconds,
+                  r.bytes / r.seconds, r.tokens / r.seconds, r.allocs_per_mb,
+                  r.peak_rss);
+    }
+    std::printf("]}\n");
+  }
+  return 0;
+}
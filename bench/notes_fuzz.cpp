@@ -0,0 +1,278 @@
+// Fuzz target for the markup parser. Builds without SDL or ImGui.
+//
+// With -DNOTES_FUZZ=ON (clang) this is a libFuzzer target that checks the
+// token invariants on arbitrary input. Otherwise it runs standalone:
+//
+//   notes_fuzz [--max-size BYTES] [--iterations N]
+//
+// which checks the same invariants on random documents, checks that edits
+// spliced in line by line give the same tokens and outline as a full
+// parse, and then times adversarial inputs at two sizes 16x apart, failing
+// if parse time grows much faster than the input.
+#include "markup.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Every token lies inside the input and, images aside, the tokens cover it
+// byte for byte in order. Each "\n" is a NewLine token of its own, so no
+// text run spans lines. Empty Text tokens only open a line or stand for an
+// empty table cell.
+static bool check_tokens(std::string_view input, const Tokens &tokens) {
+  size_t pos{0};
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens.starts[i] + size_t{tokens.lens[i]} > input.size())
+      return false;
+    if (tokens.is_image(i))
+      continue;
+    if (tokens.starts[i] != pos)
+      return false;
+    std::string_view span = tokens.view(input, i);
+    if (tokens.is_newline(i) ? span != "\n" : span.contains('\n'))
+      return false;
+    bool is_line_begin = i == 0 || tokens.is_newline(i - 1);
+    bool is_cell = tokens.formats[i] & Format_Table &&
+                   !(tokens.formats[i] & Format_Marker);
+    if (span.empty() && !is_line_begin && !is_cell)
+      return false;
+    pos += tokens.lens[i];
+  }
+  return pos == input.size();
+}
+
+static void check(std::string_view input) {
+  Tokens tokens{};
+  Parser parser{input, tokens};
+  parser.parse_all();
+  if (!check_tokens(input, tokens)) {
+    std::fprintf(stderr, "Token invariant broken on %zu byte input\n",
+                 input.size());
+    std::abort();
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  check({reinterpret_cast<const char *>(data), size});
+  return 0;
+}
+
+#ifndef NOTES_LIBFUZZER
+
+struct Case {
+  const char *input;
+  size_t headings;
+};
+
+// Inputs whose outline once came out wrong
+static const Case cases[] = {
+    // A cut-off run leaves the newline, so the next line starts afresh
+    {"*a\n# h", 1},
+    {"**/~~a\n## h\n### h", 2},
+    {"a *b\n\t*c\n# h", 1},
+    // An escaped newline carries on the line, markup included
+    {"a\\\n# h", 0},
+    {"# a\\\nb\n# c", 2},
+    {"*a\\\n# h", 0},
+};
+
+static int check_cases() {
+  int failures{0};
+  for (const Case &c : cases) {
+    check(c.input);
+    Tokens tokens{};
+    Parser parser{c.input, tokens};
+    parser.parse_all();
+    if (parser.outline.size() != c.headings) {
+      std::fprintf(stderr, "%zu headings instead of %zu in \"%s\"\n",
+                   parser.outline.size(), c.headings, c.input);
+      ++failures;
+    }
+  }
+  return failures;
+}
+
+static const char *pieces[] = {"*",  "**", "/",   "~",  "~~", "\\",  "[",
+                               "]",  "|",  "#",   "##", "###", "\t", "•",
+                               "\n", "a",  "b c", " ",  "ü",  "ok.png"};
+
+static std::string random_doc(std::mt19937 &rng, size_t n) {
+  std::uniform_int_distribution<size_t> pick(0, std::size(pieces) - 1);
+  std::string out{};
+  for (size_t i = 0; i < n; ++i)
+    out += pieces[pick(rng)];
+  return out;
+}
+
+// Few pieces, so that escaped newlines and markup at line starts are
+// common
+static const char *edit_pieces[] = {"\\", "\n", "#", "*", "/", "|",
+                                    "\t", "•",  "[", "]", "a", " "};
+
+// Random text as pieces, with the offset each piece ends at
+static std::vector<size_t> random_pieces(std::mt19937 &rng, size_t n,
+                                         std::string &out) {
+  std::uniform_int_distribution<size_t> pick(0, std::size(edit_pieces) - 1);
+  std::vector<size_t> ends{0};
+  for (size_t i = 0; i < n; ++i) {
+    out += edit_pieces[pick(rng)];
+    ends.push_back(out.size());
+  }
+  return ends;
+}
+
+static bool operator==(const Heading &a, const Heading &b) {
+  return a.level == b.level && a.start == b.start && a.end == b.end &&
+         a.row == b.row;
+}
+
+// Splices a random edit into a parsed document and checks it against
+// parsing the edited document whole. An append goes at the end of a
+// document whose last line ends in a backslash, as when a note grows on
+// disk. Returns whether the edit was local.
+static bool check_splice(std::mt19937 &rng, bool is_append) {
+  std::uniform_int_distribution<size_t> length(0, 40);
+  std::string doc{};
+  std::vector<size_t> ends = random_pieces(rng, length(rng), doc);
+  std::uniform_int_distribution<size_t> at(0, ends.size() - 1);
+  size_t a = ends[at(rng)], b = ends[at(rng)];
+  if (is_append) {
+    doc += rng() % 2 ? "\\" : "\\\n";
+    a = b = doc.size();
+  }
+
+  Tokens tokens{};
+  Parser parser{doc, tokens};
+  parser.parse_all();
+  std::vector<Heading> outline = std::move(parser.outline);
+
+  ParsedEdit edit{};
+  edit.start = std::min(a, b);
+  edit.end = std::max(a, b);
+  random_pieces(rng, length(rng) / 4, edit.text);
+  auto [head, tail] = edit_lines(doc, edit);
+  parse_edit(edit, head, tail, edit.line_end == doc.size());
+  if (!edit.is_local)
+    return false;
+  splice_edit(doc, edit, tokens, outline);
+  doc.replace(edit.start, edit.end - edit.start, edit.text);
+
+  Tokens whole{};
+  Parser reparsed{doc, whole};
+  reparsed.parse_all();
+  if (tokens.kinds != whole.kinds || tokens.formats != whole.formats ||
+      tokens.starts != whole.starts || tokens.lens != whole.lens ||
+      outline != reparsed.outline) {
+    std::fprintf(stderr, "Spliced edit differs from a full parse of:\n%s\n",
+                 doc.c_str());
+    std::abort();
+  }
+  return true;
+}
+
+struct Pattern {
+  const char *name;
+  const char *unit;
+  // Break the line every this many units, 0 for one long line
+  size_t line_units;
+};
+
+// Inputs that used to nest deeply or rescan
+static const Pattern patterns[] = {
+    {"nested markers", "**/~~", 0},
+    {"nested heading", "# **/~~*", 0},
+    {"stars", "*", 0},
+    {"slashes", "/", 0},
+    {"unclosed runs", "*a/b~~c", 0},
+    {"unclosed per line", "**/~~*/", 64},
+    {"brackets", "[", 0},
+    {"pipes", "|a", 0},
+    {"backslashes", "\\", 0},
+    {"list nesting", "• */**~~", 32},
+};
+
+static std::string build(const Pattern &p, size_t size) {
+  std::string out{};
+  out.reserve(size + 64);
+  size_t units{0};
+  while (out.size() < size) {
+    out += p.unit;
+    if (p.line_units && ++units % p.line_units == 0)
+      out += '\n';
+  }
+  return out;
+}
+
+static double time_parse(const std::string &doc) {
+  Tokens tokens{};
+  double best{1e30};
+  for (int i = 0; i < 3; ++i) {
+    Parser parser{doc, tokens};
+    auto start = std::chrono::steady_clock::now();
+    parser.parse_all();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end - start).count());
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  size_t max_size{size_t{4} << 20};
+  size_t iterations{20000};
+  for (int i = 1; i < argc; ++i) {
+    std::string arg{argv[i]};
+    if (arg == "--max-size" && i + 1 < argc) {
+      max_size = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--iterations" && i + 1 < argc) {
+      iterations = std::strtoull(argv[++i], nullptr, 10);
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--max-size BYTES] [--iterations N]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  std::mt19937 rng{1234};
+  std::uniform_int_distribution<size_t> length(0, 300);
+  for (size_t i = 0; i < iterations; ++i)
+    check(random_doc(rng, length(rng)));
+  for (const Pattern &p : patterns)
+    check(build(p, 4096));
+  std::printf("invariants held on %zu random documents\n", iterations);
+  size_t local{0};
+  for (size_t i = 0; i < iterations; ++i)
+    local += check_splice(rng, false);
+  std::printf("%zu of %zu spliced edits matched a full parse\n", local,
+              iterations);
+  local = 0;
+  for (size_t i = 0; i < iterations / 4; ++i)
+    local += check_splice(rng, true);
+  std::printf("%zu of %zu appends matched a full parse\n", local,
+              iterations / 4);
+  int failures = check_cases();
+
+  // Linear time gives a ratio near 16; quadratic would be near 256
+  const double max_ratio{48.0};
+  size_t large = std::max<size_t>(max_size, 16 * 1024);
+  size_t small = large / 16;
+  for (const Pattern &p : patterns) {
+    double t_small = time_parse(build(p, small));
+    double t_large = time_parse(build(p, large));
+    double ratio = t_large / std::max(t_small, 1e-9);
+    bool ok = ratio <= max_ratio;
+    failures += !ok;
+    std::printf("%-20s %10zu B %9.3f ms %10zu B %9.3f ms  x%5.1f %s\n",
+                p.name, small, t_small * 1e3, large, t_large * 1e3, ratio,
+                ok ? "ok" : "SUPERLINEAR");
+  }
+  return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#include "alloc_stats.hpp"
+#include <cstdlib>
+#include <new>
+
+// Per thread, so the main thread's numbers are not mixed with the
+// indexer's and other workers'
+static thread_local AllocStats stats{};
+
+AllocStats thread_alloc_stats() { return stats; }
+
+void *operator new(size_t sz) {
+  ++stats.count;
+  stats.bytes += sz;
+  if (void *p = std::malloc(sz ? sz : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+void *operator new(size_t sz, const std::nothrow_t &) noexcept {
+  ++stats.count;
+  stats.bytes += sz;
+  return std::malloc(sz ? sz : 1);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
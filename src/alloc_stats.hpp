@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+
+// Heap allocations made by the calling thread since it started. Counted by
+// the global operator new replacement in alloc_stats.cpp.
+struct AllocStats {
+  size_t count{0};
+  size_t bytes{0};
+};
+
+AllocStats thread_alloc_stats();
@@ -0,0 +1,402 @@
+#include "bundle.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path &fp) {
+#ifdef _WIN32
+  file = CreateFileW(fp.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    file = nullptr;
+    return;
+  }
+  LARGE_INTEGER size{};
+  if (!GetFileSizeEx(file, &size))
+    return;
+  len = static_cast<size_t>(size.QuadPart);
+  if (len == 0) {
+    is_mapped = true;
+    return;
+  }
+  mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+    return;
+  ptr = static_cast<const char *>(
+      MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  is_mapped = ptr != nullptr;
+#else
+  int fd = open(fp.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st{};
+  if (fstat(fd, &st) == 0) {
+    len = static_cast<size_t>(st.st_size);
+    if (len == 0) {
+      is_mapped = true;
+    } else {
+      void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        ptr = static_cast<const char *>(p);
+        is_mapped = true;
+      }
+    }
+  }
+  close(fd);
+#endif
+  if (!is_mapped)
+    len = 0;
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+  if (ptr)
+    UnmapViewOfFile(ptr);
+  if (mapping)
+    CloseHandle(mapping);
+  if (file)
+    CloseHandle(file);
+#else
+  if (ptr)
+    munmap(const_cast<char *>(ptr), len);
+#endif
+}
+
+static constexpr char bundle_magic[4]{'T', 'N', 'B', 'D'};
+static constexpr uint32_t bundle_version{1};
+static constexpr size_t header_size{32}, blob_size{40}, entry_size{16};
+// Larger files are stored uncompressed, so a corrupt size in the index
+// cannot make a read allocate more than this
+static constexpr uint64_t max_lz_size{256ull << 20};
+
+enum Compression : uint32_t {
+  Compression_None = 0,
+  // Byte-oriented LZ77, see lz_compress
+  Compression_Lz = 1,
+};
+
+template <typename T> static T load(const char *p) {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+template <typename T> static void store(std::string &out, T v) {
+  out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+// Sequence of (literal count, literals, match length, match distance) as
+// varints, ending with a zero match length. Matches are at least 4 bytes
+// and found through a single-probe hash table, which is quick and does
+// well on the repetition in notes and logs.
+static std::string lz_compress(std::string_view in) {
+  std::string out{};
+  out.reserve(in.size() / 2);
+  std::vector<uint32_t> table(1 << 14, UINT32_MAX);
+  size_t lit{0}, i{0};
+  while (i + 4 <= in.size()) {
+    uint32_t seq = load<uint32_t>(in.data() + i);
+    uint32_t &slot = table[(seq * 2654435761u) >> 18];
+    uint32_t cand = slot;
+    slot = static_cast<uint32_t>(i);
+    if (cand == UINT32_MAX || load<uint32_t>(in.data() + cand) != seq) {
+      ++i;
+      continue;
+    }
+    size_t len{4};
+    while (i + len < in.size() && in[cand + len] == in[i + len])
+      ++len;
+    write_varint(out, i - lit);
+    out.append(in.substr(lit, i - lit));
+    write_varint(out, len);
+    write_varint(out, i - cand);
+    i += len;
+    lit = i;
+  }
+  write_varint(out, in.size() - lit);
+  out.append(in.substr(lit));
+  write_varint(out, 0);
+  return out;
+}
+
+static bool lz_inflate(std::string_view in, size_t size, std::string &out) {
+  out.clear();
+  // Up front only as much as the input is likely to grow to, in case
+  // `size` is corrupt
+  out.reserve(std::min<uint64_t>(size, in.size() * 4));
+  size_t pos{0};
+  while (true) {
+    uint64_t lit, len, dist;
+    if (!read_varint(in, pos, lit) || lit > in.size() - pos ||
+        lit > size - out.size())
+      return false;
+    out.append(in.substr(pos, lit));
+    pos += lit;
+    if (!read_varint(in, pos, len))
+      return false;
+    if (len == 0)
+      break;
+    if (!read_varint(in, pos, dist) || dist == 0 || dist > out.size() ||
+        len > size - out.size())
+      return false;
+    // Byte by byte, as the match may overlap what it is producing
+    for (size_t from = out.size() - dist, k = 0; k < len; ++k)
+      out.push_back(out[from + k]);
+  }
+  return out.size() == size;
+}
+
+NoteBundle::NoteBundle(const std::filesystem::path &fp) : file(fp) {
+  std::string_view data = file.bytes();
+  if (!file.is_open() || data.size() < header_size ||
+      std::memcmp(data.data(), bundle_magic, 4) != 0 ||
+      load<uint32_t>(data.data() + 4) != bundle_version)
+    return;
+  uint64_t entry_count = load<uint64_t>(data.data() + 8);
+  uint64_t blob_count = load<uint64_t>(data.data() + 16);
+  uint64_t index = load<uint64_t>(data.data() + 24);
+  if (index < header_size || index > data.size())
+    return;
+  uint64_t avail = data.size() - index;
+  if (blob_count > avail / blob_size ||
+      entry_count > (avail - blob_count * blob_size) / entry_size)
+    return;
+
+  const char *p = data.data() + index;
+  blobs.resize(blob_count);
+  for (auto &blob : blobs) {
+    std::memcpy(&blob, p, blob_size);
+    p += blob_size;
+    if (blob.offset < header_size || blob.offset > index ||
+        blob.stored > index - blob.offset ||
+        (blob.compression == Compression_None && blob.stored != blob.size) ||
+        (blob.compression == Compression_Lz && blob.size > max_lz_size))
+      return;
+  }
+  const char *names_start = p + entry_count * entry_size;
+  size_t names_size = data.data() + data.size() - names_start;
+  names.reserve(entry_count);
+  entry_blobs.reserve(entry_count);
+  for (uint64_t i = 0; i < entry_count; ++i, p += entry_size) {
+    uint64_t offset = load<uint64_t>(p);
+    uint32_t len = load<uint32_t>(p + 8);
+    uint32_t blob = load<uint32_t>(p + 12);
+    if (offset > names_size || len > names_size - offset ||
+        blob >= blob_count)
+      return;
+    names.emplace_back(names_start + offset, len);
+    entry_blobs.push_back(blob);
+  }
+  is_valid = std::is_sorted(names.begin(), names.end());
+}
+
+size_t NoteBundle::lower_bound(std::string_view name) const {
+  return std::lower_bound(names.begin(), names.end(), name) - names.begin();
+}
+
+std::optional<size_t> NoteBundle::find(std::string_view name) const {
+  size_t i = lower_bound(name);
+  if (i == names.size() || names[i] != name)
+    return std::nullopt;
+  return i;
+}
+
+std::optional<std::string_view>
+NoteBundle::contents(size_t i, std::string &scratch) const {
+  const Blob &blob = blobs[entry_blobs[i]];
+  std::string_view stored = file.bytes().substr(blob.offset, blob.stored);
+  switch (blob.compression) {
+  case Compression_None:
+    return stored;
+  case Compression_Lz:
+    if (lz_inflate(stored, blob.size, scratch))
+      return std::string_view{scratch};
+    return std::nullopt;
+  default:
+    return std::nullopt;
+  }
+}
+
+bool pack_bundle(const std::filesystem::path &dir,
+                 const std::filesystem::path &out, bool compress) {
+  std::error_code ec;
+  std::vector<std::pair<std::string, std::filesystem::path>> files{};
+  auto it = std::filesystem::recursive_directory_iterator(
+      dir, std::filesystem::directory_options::skip_permission_denied, ec);
+  for (auto end = std::filesystem::recursive_directory_iterator();
+       !ec && it != end; it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    if (!name.empty() && name[0] == '.') {
+      if (it->is_directory(ec))
+        it.disable_recursion_pending();
+      continue;
+    }
+    std::error_code file_ec;
+    if (!it->is_regular_file(file_ec) ||
+        std::filesystem::equivalent(it->path(), out, file_ec))
+      continue;
+    files.emplace_back(it->path().lexically_relative(dir).generic_string(),
+                       it->path());
+  }
+  if (ec)
+    return false;
+  std::sort(files.begin(), files.end());
+
+  std::ofstream fs(out, std::ios::binary | std::ios::trunc);
+  if (!fs)
+    return false;
+  fs.write(std::string(header_size, '\0').data(), header_size);
+
+  std::string blob_index{}, entry_index{}, names{};
+  std::unordered_map<uint64_t, std::vector<uint32_t>> by_hash{};
+  std::vector<std::pair<uint64_t, std::filesystem::path>> blob_sources{};
+  uint64_t offset{header_size};
+  for (auto &[name, fp] : files) {
+    std::string data{read_file_binary(fp)};
+    uint64_t hash = hash_bytes(data);
+
+    // Same hash and size is almost certainly the same bytes, but check
+    uint32_t blob{UINT32_MAX};
+    for (uint32_t id : by_hash[hash]) {
+      auto &[size, src] = blob_sources[id];
+      if (size == data.size() && read_file_binary(src) == data) {
+        blob = id;
+        break;
+      }
+    }
+
+    if (blob == UINT32_MAX) {
+      blob = static_cast<uint32_t>(blob_sources.size());
+      std::string packed{};
+      uint32_t compression{Compression_None};
+      if (compress && data.size() <= max_lz_size) {
+        packed = lz_compress(data);
+        if (packed.size() < data.size() / 10 * 9)
+          compression = Compression_Lz;
+      }
+      std::string_view stored =
+          compression == Compression_Lz ? packed : std::string_view{data};
+      fs.write(stored.data(), stored.size());
+      store<uint64_t>(blob_index, offset);
+      store<uint64_t>(blob_index, stored.size());
+      store<uint64_t>(blob_index, data.size());
+      store<uint64_t>(blob_index, hash);
+      store<uint32_t>(blob_index, compression);
+      store<uint32_t>(blob_index, 0);
+      offset += stored.size();
+      by_hash[hash].push_back(blob);
+      blob_sources.emplace_back(data.size(), fp);
+    }
+
+    store<uint64_t>(entry_index, names.size());
+    store<uint32_t>(entry_index, static_cast<uint32_t>(name.size()));
+    store<uint32_t>(entry_index, blob);
+    names += name;
+  }
+
+  fs.write(blob_index.data(), blob_index.size());
+  fs.write(entry_index.data(), entry_index.size());
+  fs.write(names.data(), names.size());
+
+  std::string header(bundle_magic, 4);
+  store<uint32_t>(header, bundle_version);
+  store<uint64_t>(header, files.size());
+  store<uint64_t>(header, blob_sources.size());
+  store<uint64_t>(header, offset);
+  fs.seekp(0);
+  fs.write(header.data(), header.size());
+  fs.flush();
+  return fs.good();
+}
+
+bool unpack_bundle(const std::filesystem::path &bundle,
+                   const std::filesystem::path &dir) {
+  NoteBundle notes{bundle};
+  if (!notes.is_open())
+    return false;
+  bool ok{true};
+  std::string scratch{};
+  for (size_t i = 0; i < notes.size(); ++i) {
+    std::filesystem::path rel{std::string(notes.name(i))};
+    rel = rel.lexically_normal();
+    // Never write outside `dir`
+    if (rel.empty() || rel.is_absolute() || *rel.begin() == "..") {
+      ok = false;
+      continue;
+    }
+    auto data = notes.contents(i, scratch);
+    std::filesystem::path fp = dir / rel;
+    std::error_code ec;
+    std::filesystem::create_directories(fp.parent_path(), ec);
+    std::ofstream fs(fp, std::ios::binary | std::ios::trunc);
+    if (!data || !fs) {
+      ok = false;
+      continue;
+    }
+    fs.write(data->data(), data->size());
+    ok &= fs.good();
+  }
+  return ok;
+}
+
+std::shared_ptr<NoteBundle> find_bundle(const std::filesystem::path &fp,
+                                        std::string &entry) {
+  struct Cached {
+    std::filesystem::path fp;
+    std::filesystem::file_time_type mtime;
+    std::shared_ptr<NoteBundle> bundle;
+  };
+  static std::mutex mtx{};
+  static std::vector<Cached> cache{};
+  constexpr size_t cache_size{4};
+
+  std::filesystem::path head{};
+  auto part = fp.begin();
+  for (; part != fp.end(); ++part) {
+    head /= *part;
+    std::error_code ec;
+    if (part->extension() == NoteBundle::extension &&
+        std::filesystem::is_regular_file(head, ec))
+      break;
+  }
+  if (part == fp.end())
+    return nullptr;
+
+  std::filesystem::path rest{};
+  for (++part; part != fp.end(); ++part)
+    rest /= *part;
+  entry = rest.generic_string();
+
+  std::error_code ec;
+  auto mtime = std::filesystem::last_write_time(head, ec);
+  std::lock_guard lock{mtx};
+  auto it = std::find_if(cache.begin(), cache.end(),
+                         [&](auto &c) { return c.fp == head; });
+  std::shared_ptr<NoteBundle> bundle{};
+  if (it != cache.end()) {
+    if (it->mtime == mtime)
+      bundle = it->bundle;
+    cache.erase(it);
+  }
+  if (!bundle)
+    bundle = std::make_shared<NoteBundle>(head);
+  if (!bundle->is_open())
+    return nullptr;
+  // Most recently used last
+  cache.push_back({head, mtime, bundle});
+  if (cache.size() > cache_size)
+    cache.erase(cache.begin());
+  return bundle;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+  const char *ptr{nullptr};
+  size_t len{0};
+  bool is_mapped{false};
+#ifdef _WIN32
+  void *file{nullptr}, *mapping{nullptr};
+#endif
+
+public:
+  MappedFile(const std::filesystem::path &fp);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  bool is_open() const { return is_mapped; }
+  std::string_view bytes() const { return {ptr, len}; }
+};
+
+// Single-file notebook (.tnb). A small header points at an index of
+// sorted paths and content-addressed blobs, so identical files are stored
+// once and listing only touches the index. The file is mapped, and an
+// uncompressed blob is handed out as a slice of the mapping. Layout, all
+// integers little-endian:
+//
+//   "TNBD" u32 version u64 entries u64 blobs u64 index_offset
+//   blob data...
+//   index: blobs x {u64 offset, u64 stored, u64 size, u64 hash,
+//                   u32 compression, u32 0}
+//          entries x {u64 name_offset, u32 name_len, u32 blob}
+//          names
+class NoteBundle {
+  struct Blob {
+    uint64_t offset, stored, size, hash;
+    uint32_t compression, reserved;
+  };
+
+  MappedFile file;
+  std::vector<std::string_view> names{};
+  std::vector<uint32_t> entry_blobs{};
+  std::vector<Blob> blobs{};
+  bool is_valid{false};
+
+public:
+  static constexpr std::string_view extension{".tnb"};
+
+  NoteBundle(const std::filesystem::path &fp);
+  bool is_open() const { return is_valid; }
+  size_t size() const { return names.size(); }
+  // Relative path with '/' separators; entries are sorted by it
+  std::string_view name(size_t i) const { return names[i]; }
+  // First entry not ordered before `name`
+  size_t lower_bound(std::string_view name) const;
+  std::optional<size_t> find(std::string_view name) const;
+  // Compressed blobs are inflated into `scratch`, others are returned as a
+  // view into the mapping
+  std::optional<std::string_view> contents(size_t i,
+                                           std::string &scratch) const;
+};
+
+// Packs every file below `dir`, skipping dotfiles. With `compress`, blobs
+// that shrink noticeably are stored compressed.
+bool pack_bundle(const std::filesystem::path &dir,
+                 const std::filesystem::path &out, bool compress);
+
+// Writes every entry of a bundle back out below `dir`
+bool unpack_bundle(const std::filesystem::path &bundle,
+                   const std::filesystem::path &dir);
+
+// For a path such as notes.tnb/work/a.txt, returns the bundle and sets
+// `entry` to "work/a.txt". The bundle path itself gives an empty entry.
+// Bundles stay mapped while recently used and are reopened when the file
+// changes. Paths without a .tnb component return null without touching
+// the disk.
+std::shared_ptr<NoteBundle> find_bundle(const std::filesystem::path &fp,
+                                        std::string &entry);
@@ -0,0 +1,194 @@
+#include "document.hpp"
+#include <algorithm>
+#include <utility>
+
+using Ptr = std::shared_ptr<const RopeNode>;
+
+struct RopeNode {
+  Ptr left{}, right{};
+  // Only leaves hold text
+  std::string leaf{};
+  size_t size{0};
+  int height{0};
+};
+
+static int height_of(const Ptr &n) { return n ? n->height : -1; }
+
+static Ptr make_leaf(std::string leaf) {
+  if (leaf.empty())
+    return nullptr;
+  size_t size = leaf.size();
+  return std::make_shared<const RopeNode>(
+      RopeNode{{}, {}, std::move(leaf), size, 0});
+}
+
+static Ptr make_node(Ptr left, Ptr right) {
+  size_t size = left->size + right->size;
+  int height = std::max(left->height, right->height) + 1;
+  return std::make_shared<const RopeNode>(
+      RopeNode{std::move(left), std::move(right), {}, size, height});
+}
+
+// Joins subtrees whose heights differ by at most two with one rotation
+static Ptr balance(Ptr l, Ptr r) {
+  if (l->height > r->height + 1) {
+    if (height_of(l->left) >= height_of(l->right))
+      return make_node(l->left, make_node(l->right, std::move(r)));
+    const Ptr &lr = l->right;
+    return make_node(make_node(l->left, lr->left),
+                     make_node(lr->right, std::move(r)));
+  }
+  if (r->height > l->height + 1) {
+    if (height_of(r->right) >= height_of(r->left))
+      return make_node(make_node(std::move(l), r->left), r->right);
+    const Ptr &rl = r->left;
+    return make_node(make_node(std::move(l), rl->left),
+                     make_node(rl->right, r->right));
+  }
+  return make_node(std::move(l), std::move(r));
+}
+
+// Descends the taller side so only one path is rebuilt
+static Ptr join(Ptr a, Ptr b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+  if (a->height > b->height + 1)
+    return balance(a->left, join(a->right, std::move(b)));
+  if (b->height > a->height + 1)
+    return balance(join(std::move(a), b->left), b->right);
+  if (a->height == 0 && b->height == 0 && a->size + b->size <= Rope::max_leaf)
+    return make_leaf(a->leaf + b->leaf);
+  return make_node(std::move(a), std::move(b));
+}
+
+static std::pair<Ptr, Ptr> split(const Ptr &n, size_t pos) {
+  if (!n)
+    return {};
+  if (pos == 0)
+    return {nullptr, n};
+  if (pos >= n->size)
+    return {n, nullptr};
+  if (n->height == 0)
+    return {make_leaf(n->leaf.substr(0, pos)), make_leaf(n->leaf.substr(pos))};
+  if (pos <= n->left->size) {
+    auto [a, b] = split(n->left, pos);
+    return {std::move(a), join(std::move(b), n->right)};
+  }
+  auto [a, b] = split(n->right, pos - n->left->size);
+  return {join(n->left, std::move(a)), std::move(b)};
+}
+
+static Ptr build(std::string_view text) {
+  constexpr size_t chunk = Rope::max_leaf / 2;
+  if (text.size() <= chunk)
+    return make_leaf(std::string(text));
+  size_t mid = (text.size() + chunk - 1) / chunk / 2 * chunk;
+  return make_node(build(text.substr(0, mid)), build(text.substr(mid)));
+}
+
+// Replaces `erase` bytes at `pos` with `text` when they all fall in one
+// leaf and the result still fits, copying only the path to it. Returns
+// null otherwise.
+static Ptr edit_leaf(const Ptr &n, size_t pos, size_t erase,
+                     std::string_view text) {
+  if (n->height == 0) {
+    size_t size = n->size - erase + text.size();
+    if (size == 0 || size > Rope::max_leaf)
+      return nullptr;
+    std::string leaf{};
+    leaf.reserve(size);
+    leaf.append(n->leaf, 0, pos).append(text).append(n->leaf, pos + erase);
+    return make_leaf(std::move(leaf));
+  }
+  // Heights do not change, so the path needs no rebalancing
+  size_t left = n->left->size;
+  if (pos + erase <= left) {
+    Ptr child = edit_leaf(n->left, pos, erase, text);
+    return child ? make_node(std::move(child), n->right) : nullptr;
+  }
+  if (pos >= left) {
+    Ptr child = edit_leaf(n->right, pos - left, erase, text);
+    return child ? make_node(n->left, std::move(child)) : nullptr;
+  }
+  return nullptr;
+}
+
+static void visit(const Ptr &n,
+                  const std::function<void(std::string_view)> &fn) {
+  if (!n)
+    return;
+  if (n->height == 0) {
+    fn(n->leaf);
+    return;
+  }
+  visit(n->left, fn);
+  visit(n->right, fn);
+}
+
+Rope::Rope(std::string_view text) : root(build(text)) {}
+
+size_t Rope::size() const { return root ? root->size : 0; }
+
+Rope Rope::insert(size_t pos, std::string_view text) const {
+  pos = std::min(pos, size());
+  if (text.empty())
+    return *this;
+  if (!root)
+    return Rope{build(text)};
+  if (Ptr edited = edit_leaf(root, pos, 0, text))
+    return Rope{std::move(edited)};
+  auto [a, b] = split(root, pos);
+  return Rope{join(join(std::move(a), build(text)), std::move(b))};
+}
+
+Rope Rope::erase(size_t pos, size_t len) const {
+  pos = std::min(pos, size());
+  len = std::min(len, size() - pos);
+  if (len == 0)
+    return *this;
+  if (Ptr edited = edit_leaf(root, pos, len, {}))
+    return Rope{std::move(edited)};
+  auto [a, rest] = split(root, pos);
+  return Rope{join(std::move(a), split(rest, len).second)};
+}
+
+std::string Rope::str() const {
+  std::string out{};
+  out.reserve(size());
+  for_each_chunk([&](std::string_view chunk) { out.append(chunk); });
+  return out;
+}
+
+bool Rope::equals(std::string_view text) const {
+  if (size() != text.size())
+    return false;
+  size_t pos{0};
+  bool is_equal{true};
+  for_each_chunk([&](std::string_view chunk) {
+    is_equal = is_equal && text.substr(pos, chunk.size()) == chunk;
+    pos += chunk.size();
+  });
+  return is_equal;
+}
+
+void Rope::for_each_chunk(
+    const std::function<void(std::string_view)> &fn) const {
+  visit(root, fn);
+}
+
+void Document::insert(size_t pos, std::string_view text) {
+  rope = rope.insert(pos, text);
+  ++version;
+}
+
+void Document::erase(size_t pos, size_t len) {
+  rope = rope.erase(pos, len);
+  ++version;
+}
+
+void Document::assign(std::string_view text) {
+  rope = Rope{text};
+  ++version;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct RopeNode;
+
+// Text kept as chunks at the leaves of a persistent, height-balanced
+// tree. Nodes are never modified once built, so copies share all of them
+// and can be read from any thread. An edit copies the path down to the
+// chunks it touches and leaves the rest shared.
+class Rope {
+  using Ptr = std::shared_ptr<const RopeNode>;
+  Ptr root{};
+
+  Rope(Ptr root) : root(std::move(root)) {}
+
+public:
+  // Chunks are built at half this size so typing into one rarely splits it
+  static constexpr size_t max_leaf = 2048;
+
+  Rope() = default;
+  Rope(std::string_view text);
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  // Returns the edited rope; this one is left unchanged
+  Rope insert(size_t pos, std::string_view text) const;
+  Rope erase(size_t pos, size_t len) const;
+  std::string str() const;
+  // Compares chunk by chunk, without flattening
+  bool equals(std::string_view text) const;
+  // Calls `fn` with each chunk in order
+  void for_each_chunk(const std::function<void(std::string_view)> &fn) const;
+};
+
+// A document as it was at one version
+struct DocumentSnapshot {
+  uint64_t version{0};
+  Rope text{};
+};
+
+// The editor's text as a versioned rope. Taking a snapshot is O(1) and
+// pins that version however the document changes afterwards.
+class Document {
+  Rope rope{};
+  uint64_t version{0};
+
+public:
+  void insert(size_t pos, std::string_view text);
+  void erase(size_t pos, size_t len);
+  void assign(std::string_view text);
+  uint64_t get_version() const { return version; }
+  DocumentSnapshot snapshot() const { return {version, rope}; }
+};
@@ -1,28 +1,74 @@
 #include "editor.hpp"
 #include "SDL3/SDL_error.h"
+#include "bundle.hpp"
 #include "file_exp.hpp"
 #include "markup.hpp"
+#include "profiler.hpp"
 #include "utility.hpp"
 #include <SDL3_image/SDL_image.h>
 #include <algorithm>
 #include <backends/imgui_impl_sdlrenderer3.h>
 #include <cfloat>
+#include <cmath>
 #include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <imgui.h>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <unordered_set>
 #include <variant>
 #include <vector>
 
 float apply_head(float fsize, int head_n);
 
+void Editor::insert_text(size_t pos, std::string_view str) {
+  // The edited row is measured again; rows after it move down unchanged
+  size_t row = std::count(text.begin(), text.begin() + pos, '\n');
+  size_t added = std::count(str.begin(), str.end(), '\n');
+  if (row < measured.size()) {
+    measured[row] = 0.0f;
+    measured.insert(measured.begin() + row + 1, added, 0.0f);
+  }
+  highlighter.edit(row, 0, added);
+  minimap.edit(row, 0, added);
+  stats.insert(text, pos, str);
+  text.insert(pos, str);
+  document.insert(pos, str);
+}
+
+void Editor::erase_text(size_t pos, size_t len) {
+  len = std::min(len, text.size() - pos);
+  size_t row = std::count(text.begin(), text.begin() + pos, '\n');
+  size_t removed =
+      std::count(text.begin() + pos, text.begin() + pos + len, '\n');
+  if (row + removed < measured.size()) {
+    measured[row] = 0.0f;
+    measured.erase(measured.begin() + row + 1,
+                   measured.begin() + row + 1 + removed);
+  }
+  highlighter.edit(row, removed, 0);
+  minimap.edit(row, removed, 0);
+  stats.erase(text, pos, len);
+  text.erase(pos, len);
+  document.erase(pos, len);
+}
+
+void Editor::assign_text(std::string &&str) {
+  text = std::move(str);
+  measured.assign(std::count(text.begin(), text.end(), '\n') + 1, 0.0f);
+  highlighter.reset();
+  minimap.reset();
+  stats.assign(text);
+  document.assign(text);
+}
+
 void Editor::select_erase_exit() {
   if (select_anchor > cursor) {
-    text.erase(cursor, select_anchor - cursor);
+    erase_text(cursor, select_anchor - cursor);
   } else {
-    text.erase(select_anchor, cursor - select_anchor);
+    erase_text(select_anchor, cursor - select_anchor);
     cursor = select_anchor;
   }
   mode = EditorMode::Insert;
@@ -32,14 +78,16 @@ void Editor::select_erase_exit() {
 ImVec4 Editor::get_bg_rect() {
   int winw, winh;
   SDL_GetWindowSize(window, &winw, &winh);
-  float w = winw * width, h = winh * height;
-  float x = 0, y = 0.5f * (winh - h);
+  float w = winw * width, h = (winh - top) * height;
+  float x = 0, y = top + 0.5f * (winh - top - h);
   return {x, y, w, h};
 }
 
 void Editor::event(const SDL_Event &event) {
+  PROFILE_ZONE("Editor::event");
   if (!is_focused)
     return;
+  size_t old_cursor = cursor;
 
   static const std::unordered_set<std::string> ctrl_stop_at{
       "\n", " ", "\t", "(", ")", "{", "}",  "[",  "]",  "<", ">",
@@ -47,19 +95,17 @@ void Editor::event(const SDL_Event &event) {
       "=",  "*", "/",  "%", "&", "|", "^",  "~",  "\\", "`"};
 
   switch (event.type) {
-  case SDL_EVENT_MOUSE_WHEEL: {
-    int dir = event.wheel.integer_y;
-    if (dir > 0 && row_start > 0) {
-      --row_start;
-    } else if (dir < 0) {
-      ++row_start;
-    }
-  } break;
+  case SDL_EVENT_MOUSE_WHEEL:
+    // Touchpads send fractions of a notch, so this stays pixel-precise;
+    // render eases toward the target
+    scroll_to(scroll_target - event.wheel.y * 3 * font_size);
+    break;
   case SDL_EVENT_MOUSE_BUTTON_DOWN: {
     if (mode == EditorMode::Select) {
       mode = EditorMode::Insert;
     }
-    if (event.button.clicks == 1 && event.button.button == SDL_BUTTON_LEFT) {
+    if (event.button.clicks == 1 && event.button.button == SDL_BUTTON_LEFT &&
+        event.button.x < gutter_x) {
       do_cursor_choose = true;
       choose_x = event.button.x;
       choose_y = event.button.y;
@@ -70,53 +116,51 @@ void Editor::event(const SDL_Event &event) {
       select_erase_exit();
     }
     std::string inp(event.text.text);
-    Token hover = get_hovered_token();
-    if (!(std::holds_alternative<FormattedString>(hover) &&
-          std::get<FormattedString>(hover).format & Format_Code)) {
+    if (!(get_hovered_format() & Format_Code)) {
       if (cursor > 0) {
         size_t prev = utf8_prev_len(text, cursor);
         if (text.substr(cursor - prev, prev) == "\\") {
-          text.insert(cursor, inp.data(), inp.size());
+          insert_text(cursor, inp);
           cursor += inp.size();
           reparse();
           break;
         }
       }
       if (inp == "*") {
-        text.insert(cursor, "**");
+        insert_text(cursor, "**");
         ++cursor;
         reparse();
         break;
       } else if (inp == "/") {
-        text.insert(cursor, "//");
+        insert_text(cursor, "//");
         ++cursor;
         reparse();
         break;
       } else if (inp == "~") {
-        text.insert(cursor, "~~");
+        insert_text(cursor, "~~");
         ++cursor;
         reparse();
         break;
       } else if (inp == "-") {
         if (text.size() != 0 && text[cursor - 1] != '\n') {
-          text.insert(cursor, "-");
+          insert_text(cursor, "-");
           ++cursor;
           reparse();
           break;
         }
         std::string dot{"•"};
-        text.insert(cursor, dot);
+        insert_text(cursor, dot);
         cursor += dot.size();
         reparse();
         break;
       } else if (inp == "[") {
-        text.insert(cursor, "[]");
+        insert_text(cursor, "[]");
         ++cursor;
         reparse();
         break;
       }
     }
-    text.insert(cursor, inp.data(), inp.size());
+    insert_text(cursor, inp);
     cursor += inp.size();
     reparse();
   } break;
@@ -145,7 +189,7 @@ void Editor::event(const SDL_Event &event) {
         len = utf8_prev_len(text, cursor);
       }
       cursor -= len;
-      text.erase(cursor, len);
+      erase_text(cursor, len);
       reparse();
       normalize_cursor();
     } break;
@@ -153,17 +197,14 @@ void Editor::event(const SDL_Event &event) {
       if (mode == EditorMode::Select) {
         select_erase_exit();
       }
-      text.insert(cursor++, "\n", 1);
-      Token tok{get_hovered_token()};
-      if (std::holds_alternative<FormattedString>(tok)) {
-        FormattedString fmt{std::get<FormattedString>(tok)};
-        if (fmt.format & Format_Code) {
-          text.insert(cursor++, "\t");
-        } else if (fmt.format & Format_List) {
-          std::string dot{"•"};
-          text.insert(cursor, dot);
-          cursor += dot.size();
-        }
+      insert_text(cursor++, "\n");
+      int hover = get_hovered_format();
+      if (hover & Format_Code) {
+        insert_text(cursor++, "\t");
+      } else if (hover & Format_List) {
+        std::string dot{"•"};
+        insert_text(cursor, dot);
+        cursor += dot.size();
       }
       reparse();
       normalize_cursor();
@@ -334,34 +375,19 @@ void Editor::event(const SDL_Event &event) {
       if (mode == EditorMode::Select) {
         select_erase_exit();
       }
-      text.insert(cursor, "\t", 1);
+      insert_text(cursor, "\t");
       cursor += 1;
       reparse();
     } break;
     case SDLK_V:
       if (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL) {
-        if (mode == EditorMode::Select) {
-          select_erase_exit();
-        }
-
-        char *clip = SDL_GetClipboardText();
-        size_t clip_len = strlen(clip);
-        text.insert(cursor, clip, clip_len);
-        cursor += clip_len;
-        reparse();
-        normalize_cursor();
+        paste();
       }
       break;
     case SDLK_C:
       if (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL) {
         if (mode == EditorMode::Select) {
-          std::string select{};
-          if (select_anchor > cursor) {
-            select = text.substr(cursor, select_anchor - cursor);
-          } else {
-            select = text.substr(select_anchor, cursor - select_anchor);
-          }
-          SDL_SetClipboardText(select.c_str());
+          copy_selection();
           cursor = select_anchor;
           mode = EditorMode::Insert;
         }
@@ -370,13 +396,7 @@ void Editor::event(const SDL_Event &event) {
     case SDLK_X:
       if (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL) {
         if (mode == EditorMode::Select) {
-          std::string select{};
-          if (select_anchor > cursor) {
-            select = text.substr(cursor, select_anchor - cursor);
-          } else {
-            select = text.substr(select_anchor, cursor - select_anchor);
-          }
-          SDL_SetClipboardText(select.c_str());
+          copy_selection();
           select_erase_exit();
           reparse();
         }
@@ -394,6 +414,37 @@ void Editor::event(const SDL_Event &event) {
         save();
       }
       break;
+    case SDLK_F:
+      if (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL) {
+        if (mode == EditorMode::Select) {
+          size_t sel_start = std::min(cursor, select_anchor);
+          size_t sel_len = std::max(cursor, select_anchor) - sel_start;
+          if (sel_len > 0 && sel_len < find_input.size()) {
+            std::fill(find_input.begin(), find_input.end(), '\0');
+            text.copy(find_input.data(), sel_len, sel_start);
+          }
+        }
+        show_find = true;
+        find_focus = true;
+        refresh_search();
+      }
+      break;
+    case SDLK_O:
+      if (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL) {
+        show_outline = !show_outline;
+      }
+      break;
+    case SDLK_M:
+      if (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL) {
+        show_minimap = !show_minimap;
+      }
+      break;
+    case SDLK_F3:
+      if (show_find) {
+        find_step(!(event.key.mod & SDL_KMOD_LSHIFT ||
+                    event.key.mod & SDL_KMOD_RSHIFT));
+      }
+      break;
 
     case SDLK_HOME: {
       if (event.key.mod & SDL_KMOD_LSHIFT || event.key.mod & SDL_KMOD_RSHIFT) {
@@ -449,10 +500,18 @@ void Editor::event(const SDL_Event &event) {
     break;
   }
 
+  if (cursor != old_cursor)
+    is_view_moved = true;
   update_title();
 }
 
 void Editor::render() {
+  PROFILE_ZONE("Editor::render");
+  if (images_trimmed) {
+    images_trimmed = false;
+    update_imgs();
+  }
+
   auto [x, y, w, h] = get_bg_rect();
   ImGui::SetNextWindowPos({x, y});
   ImGui::SetNextWindowSize({w, h});
@@ -475,16 +534,47 @@ void Editor::render() {
   float content_y = y + padding;
   float content_w = w - 2.0f * padding;
   float content_h = h - 2.0f * padding;
-
-  float cx{content_x}, cy{content_y};
-  size_t idx{0};
+  // The minimap takes a strip at the right of the text
+  float minimap_x = content_x + content_w - Minimap::width;
+  if (show_minimap)
+    content_w -= Minimap::width + padding / 2;
+  float space_w = plain->CalcTextSizeA(font_size, FLT_MAX, FLT_MAX, " ").x;
+
+  view_h = content_h;
+  if (content_w != layout_w || font_size != layout_size || space_w != char_w) {
+    // Rows wrap differently now, so every measured height is stale
+    layout_w = content_w;
+    layout_size = font_size;
+    char_w = space_w;
+    std::fill(measured.begin(), measured.end(), 0.0f);
+    layout_rows();
+  }
+  // Covers a fixed share of the remaining distance per second, so
+  // scrolling glides at any frame rate
+  float old_scroll = scroll_y;
+  scroll_target = std::clamp(scroll_target, 0.0f, max_scroll());
+  scroll_y += (scroll_target - scroll_y) *
+              std::min(1.0f, ImGui::GetIO().DeltaTime * 15.0f);
+  if (std::abs(scroll_target - scroll_y) < 0.5f)
+    scroll_y = scroll_target;
+  scroll_y = std::clamp(scroll_y, 0.0f, max_scroll());
+
+  // Drawing starts at the row under the top edge, part of it scrolled off
+  size_t first_row = row_heights.find(scroll_y);
+  size_t first_token = row_tokens[first_row];
+  float cx{content_x};
+  float cy{content_y - (scroll_y - float(row_heights.offset(first_row)))};
+  size_t idx{first_token < format.size() ? format.starts[first_token]
+             : first_token > 0            ? text.size()
+                                          : 0};
 
   float current_size{font_size};
 
-  auto render = [&](ImFont *font, const std::string &text, int fmt) {
+  auto render = [&](ImFont *font, std::string_view text, int fmt) {
     size_t vtx_start = draw_list->VtxBuffer.Size;
     draw_list->AddText(font, current_size, {cx, cy},
-                       IM_COL32(0xFF, 0xFF, 0xFF, 0xFF), text.c_str());
+                       IM_COL32(0xFF, 0xFF, 0xFF, 0xFF), text.data(),
+                       text.data() + text.size());
     size_t vtx_end = draw_list->VtxBuffer.Size;
     if (fmt & Format_Italic) {
       for (size_t i = vtx_start; i < vtx_end; ++i) {
@@ -495,6 +585,47 @@ void Editor::render() {
     }
   };
 
+  // Draws a word of a code line in the colors of the spans it overlaps.
+  // `offset` is where the word starts in the line's token.
+  auto render_code = [&](ImFont *font, std::string_view word, size_t offset,
+                         const std::vector<HighlightSpan> &spans) {
+    static constexpr ImU32 colors[]{
+        IM_COL32(0xFF, 0xFF, 0xFF, 0xFF), // Plain
+        IM_COL32(0xC6, 0x78, 0xDD, 0xFF), // Keyword
+        IM_COL32(0xE5, 0xC0, 0x7B, 0xFF), // Type
+        IM_COL32(0x98, 0xC3, 0x79, 0xFF), // String
+        IM_COL32(0xD1, 0x9A, 0x66, 0xFF), // Number
+        IM_COL32(0x7F, 0x84, 0x8E, 0xFF), // Comment
+        IM_COL32(0x61, 0xAF, 0xEF, 0xFF), // Preproc
+        IM_COL32(0xE0, 0x6C, 0x75, 0xFF), // Variable
+        IM_COL32(0xE0, 0x6C, 0x75, 0xFF), // Key
+    };
+    auto span = std::ranges::upper_bound(spans, offset, {},
+                                         &HighlightSpan::start);
+    HighlightKind kind = span == spans.begin() ? HighlightKind::Plain
+                                               : std::prev(span)->kind;
+    float x = cx;
+    size_t pos{0};
+    while (pos < word.size()) {
+      size_t end = span == spans.end()
+                       ? word.size()
+                       : std::clamp<size_t>(span->start - offset, pos,
+                                            word.size());
+      if (end > pos) {
+        const char *begin = word.data() + pos;
+        draw_list->AddText(font, current_size, {x, cy},
+                           colors[static_cast<size_t>(kind)], begin,
+                           word.data() + end);
+        x += font->CalcTextSizeA(current_size, FLT_MAX, FLT_MAX, begin,
+                                 word.data() + end)
+                 .x;
+        pos = end;
+      }
+      if (span != spans.end())
+        kind = (span++)->kind;
+    }
+  };
+
   auto draw_cursor = [&](float x, float y, float height) {
     if (!is_focused)
       return;
@@ -507,49 +638,82 @@ void Editor::render() {
                              IM_COL32(0xFF, 0xFF, 0, 0x7F));
   };
 
-  auto draw_linenumber = [&](size_t row, Token &token) {
-    std::string num{std::to_string(row + 1)};
+  auto draw_match = [&](float x, float y, float w, float h) {
+    draw_list->AddRectFilled({x, y}, {x + w, y + h},
+                             IM_COL32(0xFF, 0x80, 0, 0x60));
+  };
+
+  auto draw_linenumber = [&](size_t row, size_t token) {
+    char num[24];
+    std::snprintf(num, sizeof(num), "%zu", row + 1);
     size_t sz =
-        plain->CalcTextSizeA(font_size, content_w, content_w + 10, num.c_str())
-            .x;
+        plain->CalcTextSizeA(font_size, content_w, content_w + 10, num).x;
     float fsize = font_size;
-    if (std::holds_alternative<FormattedString>(token)) {
-      auto fmt = std::get<FormattedString>(token).format;
-      fsize = apply_head(fsize, fmt);
+    if (format.is_text(token)) {
+      fsize = apply_head(fsize, format.formats[token]);
     }
     draw_list->AddText(
         plain, font_size,
         {cx - sz - (padding - sz) / 2, cy + (fsize - font_size) / 2},
-        IM_COL32(0xFF, 0xFF, 0xFF, 0x7F), num.c_str());
+        IM_COL32(0xFF, 0xFF, 0xFF, 0x7F), num);
   };
 
   size_t sel_start = std::min(cursor, select_anchor);
   size_t sel_end = std::max(cursor, select_anchor);
 
-  size_t row{0};
+  // Only matches under visible characters are looked up, by binary search
+  Matches matches{show_find ? search.get_matches() : Matches{}};
+  size_t match_len{search.query.size()};
+  auto match_it = matches ? matches->begin()
+                          : std::vector<size_t>::const_iterator{};
+  auto match_end = matches ? matches->end() : match_it;
+  auto in_match = [&](size_t idx) {
+    if (match_it == match_end)
+      return false;
+    if (*match_it + match_len <= idx) {
+      match_it = std::lower_bound(match_it, match_end,
+                                  idx + 1 > match_len ? idx + 1 - match_len
+                                                      : 0);
+    }
+    return match_it != match_end && *match_it <= idx;
+  };
+
+  size_t row{first_row};
+  float row_top{cy};
+  auto measure = [&](float height) {
+    if (measured.size() == row_heights.size() && row < measured.size() &&
+        std::abs(measured[row] - height) > 0.5f) {
+      measured[row] = height;
+      row_heights.set(row, height);
+    }
+  };
   size_t closest_idx{0};
   float closest_len{std::numeric_limits<float>().max()};
 
+  // Per-frame temporaries come from the frame arena, so an unchanged
+  // document and viewport render without heap allocations
+  frame_arena.reset();
   bool in_table{false}, is_mismatched{false};
-  std::vector<size_t> col_lengths{};
-  std::vector<size_t> table_elems{};
+  std::pmr::vector<size_t> col_lengths{&frame_arena};
+  std::pmr::vector<size_t> table_elems{&frame_arena};
   size_t col_count{};
   float deferred_gap{0};
 
-  std::vector<Image> imgs_buffer{};
+  size_t image_idx{row_images[first_row]};
+  std::pmr::vector<ImTextureID> imgs_buffer{&frame_arena};
   auto display_images = [&]() {
     float image_row = cy;
     float image_col = content_x;
-    for (auto &img : imgs_buffer) {
-      draw_list->AddImage(ImTextureRef(images[get_path_proper(img.fp)]),
-                          {image_col, image_row},
-                          {image_col + 100, image_row + 100});
+    for (ImTextureID tex : imgs_buffer) {
+      if (tex)
+        draw_list->AddImage(ImTextureRef(tex), {image_col, image_row},
+                            {image_col + 100, image_row + 100});
       image_col += 105;
       if (image_col + 100 >= content_x + content_w) {
         image_col = content_x;
         image_row += 105;
       }
-      if (image_row + 100 >= content_y + content_h) {
+      if (image_row >= content_y + content_h) {
         break;
       }
     }
@@ -557,18 +721,19 @@ void Editor::render() {
     imgs_buffer.clear();
   };
 
-  for (size_t i = 0; i < format.size(); ++i) {
-    Token &token = format[i];
-    if (row >= row_start && cx == content_x) {
-      draw_linenumber(row, token);
+  // Rows cut by the bottom edge are drawn clipped, and measured only if
+  // they were laid out in full
+  draw_list->PushClipRect({x, content_y}, {x + w, content_y + content_h},
+                          true);
+  std::string_view source{text};
+  size_t i = first_token;
+  for (; i < format.size(); ++i) {
+    TokenKind kind = format.kinds[i];
+    if (cx == content_x) {
+      draw_linenumber(row, i);
     }
 
-    if (std::holds_alternative<NewLine>(token)) {
-      if (row < row_start) {
-        ++row;
-        ++idx;
-        continue;
-      }
+    if (kind == TokenKind::NewLine) {
       if (idx == cursor) {
         draw_cursor(cx, cy, current_size);
       }
@@ -576,8 +741,10 @@ void Editor::render() {
       if (imgs_buffer.size() > 0) {
         display_images();
       }
-      if (cy >= content_y + content_h - current_size)
+      if (cy >= content_y + content_h)
         break;
+      measure(cy - row_top);
+      row_top = cy;
       if (do_cursor_choose) {
         float dx = cx - choose_x;
         float dy = cy + current_size / 2 - choose_y;
@@ -594,109 +761,101 @@ void Editor::render() {
       continue;
     }
 
-    if (std::holds_alternative<FormattedString>(token)) {
-      auto fmt = std::get<FormattedString>(token);
-      if (row < row_start) {
-        idx += fmt.value.size();
-        continue;
-      }
+    if (kind == TokenKind::Text) {
+      std::string_view value = format.view(source, i);
+      int fmt_flags = format.formats[i];
 
-      if (fmt.format & Format_Table && !in_table) {
+      if (fmt_flags & Format_Table && !in_table) {
         in_table = true;
         is_mismatched = false;
         col_lengths.clear();
         table_elems.clear();
         col_count = 0;
         size_t idx = i;
-        std::vector<std::vector<std::string>> table;
-        std::vector<std::string> current_row;
+        // Rows are contiguous slices of table_elems
+        std::pmr::vector<size_t> row_ends{&frame_arena};
+        size_t row_start_elem{0};
 
         while (idx < format.size()) {
-          if (std::holds_alternative<NewLine>(format[idx])) {
+          if (format.is_newline(idx)) {
             if (idx != format.size() - 1) {
-              if (!std::holds_alternative<FormattedString>(format[idx + 1]))
+              if (!format.is_text(idx + 1))
                 break;
-              if (!(std::get<FormattedString>(format[idx + 1]).format &
-                    Format_Table))
+              if (!(format.formats[idx + 1] & Format_Table))
                 break;
             }
-            if (!current_row.empty()) {
-              table.push_back(current_row);
-              current_row.clear();
+            if (table_elems.size() > row_start_elem) {
+              row_ends.push_back(table_elems.size());
+              row_start_elem = table_elems.size();
             }
             ++idx;
             continue;
           }
-          if (!std::holds_alternative<FormattedString>(format[idx])) {
+          if (!format.is_text(idx)) {
             break;
           }
-          auto fmt = std::get<FormattedString>(format[idx]);
-          if (!(fmt.format & Format_Table))
+          if (!(format.formats[idx] & Format_Table))
             break;
-          if (fmt.value == "|") {
+          if (format.formats[idx] & Format_Marker) {
             ++idx;
             continue;
           }
-          current_row.push_back(fmt.value);
           table_elems.push_back(idx);
           ++idx;
         }
 
-        if (!current_row.empty())
-          table.push_back(current_row);
+        if (table_elems.size() > row_start_elem)
+          row_ends.push_back(table_elems.size());
 
-        for (auto &row : table) {
+        size_t prev_end{0};
+        for (size_t end : row_ends) {
           if (col_count == 0) {
-            col_count = row.size();
+            col_count = end - prev_end;
           } else {
-            if (col_count != row.size()) {
+            if (col_count != end - prev_end) {
               is_mismatched = true;
             }
           }
+          prev_end = end;
         }
 
         if (!is_mismatched) {
           col_lengths.clear();
           col_lengths.resize(col_count);
 
-          for (size_t c = 0; c < col_count; ++c) {
-            for (auto &row : table) {
-              col_lengths[c] = std::max(col_lengths[c], row[c].size());
-            }
+          for (size_t m = 0; m < table_elems.size(); ++m) {
+            size_t &len = col_lengths[m % col_count];
+            len = std::max<size_t>(len, format.lens[table_elems[m]]);
           }
         }
-      } else if (!(fmt.format & Format_Table)) {
+      } else if (!(fmt_flags & Format_Table)) {
         in_table = false;
       }
 
-      ImFont *font = (fmt.format & Format_Bold) ? bold : plain;
+      ImFont *font = (fmt_flags & Format_Bold) ? bold : plain;
 
-      current_size = apply_head(font_size, fmt.format);
+      current_size = apply_head(font_size, fmt_flags);
 
       float block_start = cy;
 
-      if ((i == 0 || std::holds_alternative<NewLine>(format[i - 1])) &&
-          fmt.format & Format_List) {
+      if ((i == 0 || format.is_newline(i - 1)) && fmt_flags & Format_List) {
         cx += 15;
       }
 
-      std::string text = fmt.value;
+      std::string_view text = value;
       size_t pos = 0;
 
       float gap_len{0};
-      bool is_gap = (fmt.format & Format_Table && !is_mismatched);
+      bool is_gap = (fmt_flags & Format_Table && !is_mismatched);
       if (is_gap) {
         for (size_t m = 0; m < table_elems.size(); ++m) {
           size_t elem_idx = table_elems[m];
           if (i != elem_idx)
             continue;
           size_t col = m % col_count;
-          size_t gap = col_lengths[col] - fmt.value.size();
-          std::string fill{};
-          for (size_t i = 0; i < gap; ++i)
-            fill += " ";
-          gap_len =
-              font->CalcTextSizeA(font_size, FLT_MAX, FLT_MAX, fill.c_str()).x;
+          size_t gap = col_lengths[col] - value.size();
+          // The editor fonts are monospaced
+          gap_len = gap * space_w;
         }
       }
 
@@ -708,45 +867,47 @@ void Editor::render() {
         if (next_space == std::string::npos)
           next_space = text.size();
 
-        std::string word = text.substr(pos, next_space - pos);
-        if (next_space < text.size())
-          word += ' ';
+        std::string_view word = text.substr(
+            pos, std::min(next_space + 1, text.size()) - pos);
+        const char *word_begin = word.data();
 
-        float word_width =
-            font->CalcTextSizeA(current_size, FLT_MAX, FLT_MAX, word.c_str()).x;
+        auto text_width = [&](size_t len) {
+          return font
+              ->CalcTextSizeA(current_size, FLT_MAX, FLT_MAX, word_begin,
+                              word_begin + len)
+              .x;
+        };
 
-        if (fmt.format & Format_Strike) {
+        float word_width = text_width(word.size());
+
+        if (fmt_flags & Format_Strike) {
           float sz = 1.0f;
-          sz = apply_head(sz, fmt.format);
+          sz = apply_head(sz, fmt_flags);
           draw_list->AddRectFilled(
               {cx, cy + current_size / 2 - sz / 2},
               {cx + word_width, cy + current_size / 2 + sz / 2},
               IM_COL32(0xFF, 0xFF, 0xFF, 0xFF));
         }
 
-        if (fmt.format & Format_Table &&
+        if (fmt_flags & Format_Table &&
             std::ranges::contains(table_elems, i) && !is_mismatched) {
           font = bold;
-          fmt.format |= Format_Bold;
+          fmt_flags |= Format_Bold;
         }
 
         if (cx + word_width > content_x + content_w) {
           cx = content_x;
           cy += current_size;
-          if (cy >= content_y + content_h - current_size)
+          if (cy >= content_y + content_h)
             break;
         }
 
         size_t char_pos = 0;
         while (char_pos < word.size()) {
-          size_t len = utf8_next_len(word, char_pos);
+          size_t len = utf8_next_len(value, pos + char_pos);
 
           if (idx == cursor) {
-            std::string sub = word.substr(0, char_pos);
-            float cursor_x = cx + font->CalcTextSizeA(current_size, FLT_MAX,
-                                                      FLT_MAX, sub.c_str())
-                                      .x;
-            draw_cursor(cursor_x, cy, current_size);
+            draw_cursor(cx + text_width(char_pos), cy, current_size);
           }
 
           if (deferred_gap) {
@@ -755,10 +916,7 @@ void Editor::render() {
           }
 
           if (do_cursor_choose) {
-            std::string sub = word.substr(0, char_pos);
-            float cursor_x = cx + font->CalcTextSizeA(current_size, FLT_MAX,
-                                                      FLT_MAX, sub.c_str())
-                                      .x;
+            float cursor_x = cx + text_width(char_pos);
             float dx = cursor_x - choose_x;
             float dy = cy + current_size / 2 - choose_y;
             float dist = SDL_sqrtf(dx * dx + dy * dy);
@@ -768,24 +926,29 @@ void Editor::render() {
             }
           }
 
-          if (mode == EditorMode::Select && idx >= sel_start && idx < sel_end) {
-            std::string sub = word.substr(0, char_pos + len);
-            std::string prev = word.substr(0, char_pos);
-            float sub_width =
-                font->CalcTextSizeA(current_size, FLT_MAX, FLT_MAX, sub.c_str())
-                    .x;
-            float prev_width = font->CalcTextSizeA(current_size, FLT_MAX,
-                                                   FLT_MAX, prev.c_str())
-                                   .x;
-            draw_selection(cx + prev_width, cy, sub_width - prev_width,
-                           current_size);
+          bool is_selected =
+              mode == EditorMode::Select && idx >= sel_start && idx < sel_end;
+          bool is_match = in_match(idx);
+          if (is_selected || is_match) {
+            float sub_width = text_width(char_pos + len);
+            float prev_width = text_width(char_pos);
+            if (is_match)
+              draw_match(cx + prev_width, cy, sub_width - prev_width,
+                         current_size);
+            if (is_selected)
+              draw_selection(cx + prev_width, cy, sub_width - prev_width,
+                             current_size);
           }
 
           idx += len;
           char_pos += len;
         }
 
-        render(font, word, fmt.format);
+        if (fmt_flags & Format_Code)
+          render_code(font, word, word.data() - value.data(),
+                      highlighter.spans(row));
+        else
+          render(font, word, fmt_flags);
         cx += word_width;
         pos = next_space + 1;
       }
@@ -796,7 +959,7 @@ void Editor::render() {
         deferred_gap = gap_len / 2;
       }
 
-      if (fmt.format & Format_Code) {
+      if (fmt_flags & Format_Code) {
         draw_list->AddRectFilled({content_x, block_start},
                                  {content_x + 2, cy + current_size},
                                  IM_COL32(0xFF, 0xFF, 0xFF, 0xFF));
@@ -805,19 +968,23 @@ void Editor::render() {
       continue;
     }
 
-    if (std::holds_alternative<Image>(token)) {
+    if (kind == TokenKind::Image) {
       in_table = false;
-      if (row < row_start) {
-        continue;
-      }
-      imgs_buffer.emplace_back(std::get<Image>(token));
+      size_t img = image_idx++;
+      imgs_buffer.push_back(img < image_textures.size() ? image_textures[img]
+                                                        : ImTextureID{});
       continue;
     }
   }
 
-  if (format.size() > 0 && std::holds_alternative<NewLine>(format.back())) {
-    draw_linenumber(row, format.back());
+  if (i == format.size()) {
+    if (format.size() > 0 && format.is_newline(format.size() - 1)) {
+      draw_linenumber(row, format.size() - 1);
+    }
+    if (cy + current_size < content_y + content_h)
+      measure(cy + current_size - row_top);
   }
+  draw_list->PopClipRect();
 
   if (idx == cursor) {
     draw_cursor(cx, cy, current_size);
@@ -830,9 +997,118 @@ void Editor::render() {
       cursor = closest_idx;
     }
     do_cursor_choose = false;
+    is_view_moved = true;
+  }
+
+  if (is_pasting) {
+    char pasting[32];
+    std::snprintf(pasting, sizeof(pasting), "Pasting... %zu%%",
+                  paste_progress->load(std::memory_order_relaxed) * 100 /
+                      std::max<size_t>(paste_total, 1));
+    draw_list->AddText(plain, font_size, {content_x, content_y},
+                       IM_COL32(0xFF, 0xFF, 0xFF, 0x7F), pasting);
+  } else if (is_parsing) {
+    draw_list->AddText(plain, font_size, {content_x, content_y},
+                       IM_COL32(0xFF, 0xFF, 0xFF, 0x7F), "Parsing...");
   }
 
-  row_max = std::max<float>(row, content_h / font_size);
+  if (show_minimap) {
+    // Squeezed into the view when the map is taller than it
+    float map_h = std::min(content_h, float(minimap.rows()));
+    float scale = map_h / std::max(1, minimap.rows());
+    minimap.draw(renderer, draw_list, {minimap_x, content_y},
+                 {minimap_x + Minimap::width, content_y + map_h});
+    auto line_at = [&](float offset) {
+      size_t row = row_heights.find(offset);
+      float height = row_heights.get(row);
+      float into = offset - float(row_heights.offset(row));
+      return row + (height > 0.0f ? std::clamp(into / height, 0.0f, 1.0f)
+                                  : 0.0f);
+    };
+    float view_top = minimap.line_to_row(line_at(scroll_y)) * scale;
+    float view_bottom =
+        minimap.line_to_row(line_at(scroll_y + content_h)) * scale;
+    draw_list->AddRectFilled(
+        {minimap_x, content_y + view_top},
+        {minimap_x + Minimap::width,
+         content_y + std::max(view_bottom, view_top + 2.0f)},
+        IM_COL32(0xFF, 0xFF, 0xFF, 0x20));
+    // Clicking or dragging centers the view on that line
+    ImGui::SetCursorScreenPos({minimap_x, content_y});
+    ImGui::InvisibleButton("##minimap",
+                           {float(Minimap::width), std::max(map_h, 1.0f)});
+    if (ImGui::IsItemActive() && scale > 0.0f) {
+      double line =
+          minimap.row_to_line((ImGui::GetMousePos().y - content_y) / scale);
+      size_t row = std::min(size_t(std::max(line, 0.0)),
+                            row_heights.size() - 1);
+      scroll_to(float(row_heights.offset(row)) - content_h / 2);
+    }
+  }
+
+  // Proportional scrollbar in the right margin; the thumb can be dragged
+  // and clicking the track jumps there
+  float bar_w{8.0f};
+  float scrollbar_x = x + w - padding / 2 - bar_w / 2;
+  gutter_x = show_minimap ? minimap_x : scrollbar_x;
+  float total = float(row_heights.total());
+  if (max_scroll() > 0.0f) {
+    float thumb_h = std::max(24.0f, content_h * content_h / total);
+    float track = content_h - thumb_h;
+    float thumb_y = content_y + scroll_y / max_scroll() * track;
+    ImGui::SetCursorScreenPos({scrollbar_x, content_y});
+    ImGui::InvisibleButton("##scrollbar", {bar_w, content_h});
+    if (ImGui::IsItemActivated()) {
+      float mouse_y = ImGui::GetMousePos().y;
+      bool on_thumb = mouse_y >= thumb_y && mouse_y < thumb_y + thumb_h;
+      scroll_grab = on_thumb ? mouse_y - thumb_y : thumb_h / 2;
+    }
+    if (ImGui::IsItemActive() && track > 0.0f) {
+      float at = (ImGui::GetMousePos().y - scroll_grab - content_y) / track;
+      scroll_y = scroll_target = std::clamp(at, 0.0f, 1.0f) * max_scroll();
+      thumb_y = content_y + scroll_y / max_scroll() * track;
+    }
+    bool is_hot = ImGui::IsItemActive() || ImGui::IsItemHovered();
+    draw_list->AddRectFilled({scrollbar_x, content_y},
+                             {scrollbar_x + bar_w, content_y + content_h},
+                             IM_COL32(0xFF, 0xFF, 0xFF, 0x10), bar_w / 2);
+    draw_list->AddRectFilled({scrollbar_x, thumb_y},
+                             {scrollbar_x + bar_w, thumb_y + thumb_h},
+                             IM_COL32(0xFF, 0xFF, 0xFF, is_hot ? 0x80 : 0x40),
+                             bar_w / 2);
+  }
+  if (scroll_y != old_scroll)
+    is_view_moved = true;
+
+  // Document counts in the bottom margin, and the selection's while
+  // selecting
+  const TextCounts &counts = stats.get();
+  char status[256];
+  int status_len = std::snprintf(
+      status, sizeof(status),
+      "%zu words  %zu chars  %zu lines  %zu headings  %zu tables  "
+      "%zu images",
+      counts.words, counts.codepoints, counts.newlines + 1, outline.size(),
+      table_count, image_paths.size());
+  if (mode == EditorMode::Select && status_len > 0 &&
+      size_t(status_len) < sizeof(status)) {
+    if (sel_start != selection_start || sel_end != selection_end ||
+        document.get_version() != selection_version) {
+      selection_start = sel_start;
+      selection_end = sel_end;
+      selection_version = document.get_version();
+      selection_counts = count_text(
+          std::string_view(text).substr(sel_start, sel_end - sel_start));
+    }
+    std::snprintf(status + status_len, sizeof(status) - status_len,
+                  "    Selected: %zu words  %zu chars  %zu lines",
+                  selection_counts.words, selection_counts.codepoints,
+                  selection_counts.newlines + 1);
+  }
+  float status_size = std::round(font_size * 0.75f);
+  draw_list->AddText(plain, status_size,
+                     {content_x, y + h - (padding + status_size) / 2},
+                     IM_COL32(0xFF, 0xFF, 0xFF, 0x7F), status);
 
   ImGui::End();
 
@@ -850,6 +1126,16 @@ void Editor::render() {
     ImGui::EndPopup();
   }
 
+  render_conflict();
+
+  if (show_outline) {
+    render_outline();
+  }
+
+  if (show_find) {
+    render_find();
+  }
+
   if (ask_save) {
     if (!save_explorer.is_closed) {
       ImGui::SetNextWindowFocus();
@@ -861,32 +1147,394 @@ void Editor::render() {
 }
 
 void Editor::reparse() {
-  Parser parser{text};
+  PROFILE_ZONE("Editor::reparse");
+  ++parse_generation;
+  is_parsing = false;
+  // Parsing into the existing buffer reuses its capacity across edits
+  Parser parser{text, format};
   parser.parse_all();
-  format = std::move(parser.tokens);
+  outline = std::move(parser.outline);
+  layout_rows();
   update_imgs();
+  if (show_find) {
+    refresh_search();
+  }
 }
 
-void Editor::update_imgs() {
-  for (auto &token : format) {
-    if (std::holds_alternative<Image>(token)) {
-      Image img = std::get<Image>(token);
-      std::filesystem::path img_fp = get_path_proper(img.fp);
-      SDL_Surface *surf = IMG_Load(img_fp.string().c_str());
-      if (!surf) {
-        SDL_Log("IMG_Load failed for '%s': %s", img_fp.string().c_str(),
-                SDL_GetError());
+void Editor::paste() {
+  // SDL allocates the clipboard text and it must be released with SDL_free
+  std::shared_ptr<char> clip(SDL_GetClipboardText(), SDL_free);
+  if (!clip || !*clip)
+    return;
+  std::string_view data{clip.get()};
+
+  ParsedEdit edit{};
+  edit.start = edit.end = cursor;
+  if (mode == EditorMode::Select) {
+    edit.start = std::min(cursor, select_anchor);
+    edit.end = std::max(cursor, select_anchor);
+    mode = EditorMode::Insert;
+  }
+  if (is_parsing || data.size() < async_paste_bytes) {
+    ++paste_generation;
+    is_pasting = false;
+    edit.text = normalize_text(data);
+    splice(std::move(edit));
+    return;
+  }
+
+  auto [head, tail] = edit_lines(text, edit);
+
+  size_t generation = ++paste_generation;
+  uint64_t version = document.get_version();
+  is_pasting = true;
+  paste_total = data.size();
+  paste_progress = std::make_shared<std::atomic<size_t>>(0);
+  bool is_last_line = edit.line_end == text.size();
+  auto work = [this, generation, version, clip, data, is_last_line,
+               progress = paste_progress, edit = std::move(edit),
+               head = std::string(head),
+               tail = std::string(tail)](std::stop_token) mutable {
+    edit.text = normalize_text(data, progress.get());
+    parse_edit(edit, head, tail, is_last_line);
+    tasks.post([this, generation, version, edit = std::move(edit)]() mutable {
+      if (generation != paste_generation)
         return;
+      is_pasting = false;
+      if (document.get_version() == version && !is_parsing) {
+        apply_edit(std::move(edit));
+      } else {
+        // Edited meanwhile; the paste goes in at the cursor instead
+        insert_text(cursor, edit.text);
+        cursor += edit.text.size();
+        mode = EditorMode::Insert;
+        reparse();
+        normalize_cursor();
       }
-      SDL_Texture *tex = SDL_CreateTextureFromSurface(renderer, surf);
-      SDL_DestroySurface(surf);
-      if (!tex)
-        return;
-      if (images.contains(img_fp)) {
-        SDL_DestroyTexture(reinterpret_cast<SDL_Texture *>(images[img_fp]));
+      update_title();
+    });
+  };
+  tasks.run(TaskPriority::Interactive, std::move(work));
+}
+
+void Editor::splice(ParsedEdit &&edit) {
+  // Tokens from before a parse in flight do not match the text
+  if (is_parsing) {
+    erase_text(edit.start, edit.end - edit.start);
+    insert_text(edit.start, edit.text);
+    cursor = edit.start + edit.text.size();
+    reparse();
+    normalize_cursor();
+    return;
+  }
+  // Lines are parsed independently, so only the ones the edit lands in
+  // are parsed again
+  auto [head, tail] = edit_lines(text, edit);
+  parse_edit(edit, head, tail, edit.line_end == text.size());
+  apply_edit(std::move(edit));
+}
+
+void Editor::apply_edit(ParsedEdit &&edit) {
+  PROFILE_ZONE("Editor::apply_edit");
+  if (!edit.is_local) {
+    erase_text(edit.start, edit.end - edit.start);
+    insert_text(edit.start, edit.text);
+    cursor = edit.start + edit.text.size();
+    reparse();
+    normalize_cursor();
+    return;
+  }
+  splice_edit(text, edit, format, outline);
+  erase_text(edit.start, edit.end - edit.start);
+  insert_text(edit.start, edit.text);
+  cursor = edit.start + edit.text.size();
+
+  // A parse started before this edit would undo it
+  ++parse_generation;
+  layout_rows();
+  update_imgs();
+  if (show_find) {
+    refresh_search();
+  }
+  normalize_cursor();
+}
+
+void Editor::copy_selection() {
+  size_t start = std::min(cursor, select_anchor);
+  size_t end = std::min(std::max(cursor, select_anchor), text.size());
+  // SDL copies up to a NUL, so the selection is cut off in place for the
+  // call rather than copied out first
+  char after = text[end];
+  text[end] = '\0';
+  SDL_SetClipboardText(text.data() + start);
+  text[end] = after;
+}
+
+void Editor::layout_rows() {
+  PROFILE_ZONE("Editor::layout_rows");
+  row_tokens.assign(1, 0);
+  row_images.assign(1, 0);
+  uint32_t images{0};
+  bool was_table{false};
+  table_count = 0;
+  for (size_t i = 0; i < format.size(); ++i) {
+    if (i == row_tokens.back()) {
+      // Consecutive table rows make one table
+      bool is_table = format.is_text(i) && format.formats[i] & Format_Table;
+      table_count += is_table && !was_table;
+      was_table = is_table;
+    }
+    if (format.is_image(i)) {
+      ++images;
+    } else if (format.is_newline(i)) {
+      row_tokens.push_back(i + 1);
+      row_images.push_back(images);
+    }
+  }
+
+  // Rows not drawn yet are estimated from their tokens, which is close
+  // since the editor fonts are monospaced. Render corrects them as they
+  // come into view.
+  size_t rows = row_tokens.size();
+  bool is_measured = measured.size() == rows;
+  size_t per_row = layout_w > 100 ? size_t((layout_w - 100) / 105) + 1 : 1;
+  std::vector<float> heights(rows);
+  for (size_t r = 0; r < rows; ++r) {
+    if (is_measured && measured[r] > 0.0f) {
+      heights[r] = measured[r];
+      continue;
+    }
+    size_t end = r + 1 < rows ? row_tokens[r + 1] : format.size();
+    float size{font_size}, width{0.0f};
+    size_t image_count{0};
+    for (size_t i = row_tokens[r]; i < end; ++i) {
+      if (format.is_text(i)) {
+        size = apply_head(font_size, format.formats[i]);
+        std::string_view value = format.view(text, i);
+        size_t chars = std::count_if(value.begin(), value.end(), [](char c) {
+          return (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+        });
+        width += chars * char_w * size / font_size;
+      } else if (format.is_image(i)) {
+        ++image_count;
       }
-      images[img_fp] = reinterpret_cast<ImTextureID>(tex);
-    };
+    }
+    float lines{1.0f};
+    if (layout_w > 0.0f)
+      lines = std::max(1.0f, std::ceil(width / layout_w));
+    heights[r] = lines * size;
+    // Images wrap in rows of 105 px and always leave one row after them
+    if (image_count > 0)
+      heights[r] += (image_count / per_row + 1) * 105.0f;
+  }
+  row_heights.assign(std::move(heights));
+  minimap.update(format, text, row_tokens);
+  highlighter.update(format, text, row_tokens);
+}
+
+float Editor::max_scroll() {
+  return std::max(0.0f, float(row_heights.total()) - view_h);
+}
+
+void Editor::scroll_to(float offset) {
+  scroll_target = std::clamp(offset, 0.0f, max_scroll());
+}
+
+void Editor::render_outline() {
+  auto [x, y, w, h] = get_bg_rect();
+  float outline_w = std::min(w / 3, 260.0f);
+  ImGui::SetNextWindowPos({x + w - outline_w - 10.0f, y + h / 6});
+  ImGui::SetNextWindowSize({outline_w, h * 2 / 3});
+  ImGui::Begin("Outline", nullptr,
+               ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove);
+
+  if (outline.empty()) {
+    ImGui::TextDisabled("%s", "No headings");
+  }
+
+  // Section containing the cursor
+  auto current = std::upper_bound(
+      outline.begin(), outline.end(), cursor,
+      [](size_t pos, const Heading &head) { return pos < head.start; });
+  size_t current_idx = current - outline.begin() - 1;
+
+  for (size_t i = 0; i < outline.size(); ++i) {
+    const Heading &head = outline[i];
+    float indent = 12.0f * (head.level - 1);
+    ImGui::PushID(i);
+    if (indent > 0)
+      ImGui::Indent(indent);
+    if (ImGui::Selectable("##Heading", i == current_idx)) {
+      mode = EditorMode::Insert;
+      cursor = head.start;
+      scroll_to(float(row_heights.offset(head.row)));
+      normalize_cursor();
+    }
+    ImGui::SameLine();
+    ImGui::TextUnformatted(text.data() + head.start, text.data() + head.end);
+    if (indent > 0)
+      ImGui::Unindent(indent);
+    ImGui::PopID();
+  }
+
+  ImGui::End();
+}
+
+void Editor::render_find() {
+  auto [x, y, w, h] = get_bg_rect();
+  float find_w = std::min(w - 20.0f, 420.0f);
+  ImGui::SetNextWindowPos({x + w - find_w - 10.0f, y + 10.0f});
+  ImGui::SetNextWindowSize({find_w, 0});
+  ImGui::Begin("Find", nullptr,
+               ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+                   ImGuiWindowFlags_AlwaysAutoResize);
+
+  if (find_focus) {
+    ImGui::SetKeyboardFocusHere();
+    find_focus = false;
+  }
+  if (ImGui::InputText("Find", find_input.data(), find_input.size(),
+                       ImGuiInputTextFlags_EnterReturnsTrue)) {
+    find_step(!ImGui::IsKeyDown(ImGuiKey_LeftShift));
+    find_focus = true;
+  }
+  if (search.query != find_input.c_str()) {
+    refresh_search();
+  }
+
+  ImGui::InputText("Replace", replace_input.data(), replace_input.size());
+
+  if (ImGui::Checkbox("Ignore case", &search.ignore_case)) {
+    refresh_search();
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Prev")) {
+    find_step(false);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Next")) {
+    find_step(true);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Replace All")) {
+    replace_matches();
+  }
+
+  if (search.query.empty()) {
+    ImGui::Text("%s", "");
+  } else if (search.is_running()) {
+    ImGui::Text("%s", "Searching...");
+  } else {
+    ImGui::Text("%zu matches", search.get_matches()->size());
+  }
+
+  if (ImGui::IsWindowFocused() && ImGui::IsKeyPressed(ImGuiKey_Escape)) {
+    show_find = false;
+    search.clear();
+  }
+
+  ImGui::End();
+}
+
+void Editor::refresh_search() {
+  search.query = find_input.c_str();
+  search.start(snapshot());
+}
+
+void Editor::find_step(bool forward) {
+  if (search.query.empty())
+    return;
+  Matches matches{search.get_matches()};
+  if (matches->empty())
+    return;
+  // Stepping from a match's start must move past it
+  auto it = forward
+                ? std::upper_bound(matches->begin(), matches->end(), cursor)
+                : std::lower_bound(matches->begin(), matches->end(), cursor);
+  if (forward) {
+    if (it == matches->end())
+      it = matches->begin();
+  } else {
+    it = it == matches->begin() ? matches->end() - 1 : it - 1;
+  }
+  mode = EditorMode::Select;
+  select_anchor = *it + search.query.size();
+  cursor = *it;
+  normalize_cursor();
+}
+
+void Editor::replace_matches() {
+  if (search.query.empty())
+    return;
+  size_t count{0};
+  std::string replaced{replace_all(text, search.query, replace_input.c_str(),
+                                   search.ignore_case, cursor, count)};
+  if (count == 0)
+    return;
+  assign_text(std::move(replaced));
+  mode = EditorMode::Insert;
+  reparse();
+  normalize_cursor();
+  update_title();
+}
+
+static SDL_Surface *load_image(const std::filesystem::path &fp) {
+  std::string entry{};
+  if (auto bundle = find_bundle(fp, entry)) {
+    std::string scratch{};
+    std::optional<size_t> i = bundle->find(entry);
+    std::optional<std::string_view> bytes{};
+    if (i && (bytes = bundle->contents(*i, scratch)))
+      return IMG_Load_IO(SDL_IOFromConstMem(bytes->data(), bytes->size()),
+                         true);
+    return nullptr;
+  }
+  return IMG_Load(fp.string().c_str());
+}
+
+void Editor::update_imgs() {
+  PROFILE_ZONE("Editor::update_imgs");
+  // Decoding runs on the task pool and each texture is created on the main
+  // thread once its image arrives. Images already loaded are kept.
+  image_paths.clear();
+  for (size_t i = 0; i < format.size(); ++i) {
+    if (!format.is_image(i))
+      continue;
+    std::filesystem::path img_fp = get_path_proper(format.view(text, i));
+    image_paths.push_back(img_fp);
+    if (images.contains(img_fp) || !decoding.insert(img_fp).second)
+      continue;
+    tasks.run(TaskPriority::Background, [this, img_fp](std::stop_token) {
+      // Owned, so a completion dropped with the editor still frees it
+      std::shared_ptr<SDL_Surface> surf{load_image(img_fp),
+                                        SDL_DestroySurface};
+      if (!surf)
+        SDL_Log("IMG_Load failed for '%s': %s", img_fp.string().c_str(),
+                SDL_GetError());
+      tasks.post([this, img_fp, surf]() {
+        decoding.erase(img_fp);
+        if (!surf)
+          return;
+        SDL_Texture *tex = SDL_CreateTextureFromSurface(renderer, surf.get());
+        if (!tex)
+          return;
+        if (images.contains(img_fp)) {
+          SDL_DestroyTexture(reinterpret_cast<SDL_Texture *>(images[img_fp]));
+        }
+        images[img_fp] = reinterpret_cast<ImTextureID>(tex);
+        resolve_imgs();
+      });
+    });
+  }
+  resolve_imgs();
+}
+
+void Editor::resolve_imgs() {
+  // Resolved once here so render can index textures by image order
+  image_textures.clear();
+  for (auto &img_fp : image_paths) {
+    auto it = images.find(img_fp);
+    image_textures.push_back(it != images.end() ? it->second : ImTextureID{});
   }
 }
 
@@ -899,18 +1547,386 @@ std::filesystem::path Editor::get_path_proper(std::filesystem::path img_fp) {
     if (std::filesystem::exists(fp) && std::filesystem::is_regular_file(fp)) {
       return fp;
     }
+    // Notes opened from a bundle find their images inside it
+    std::string entry{};
+    if (auto bundle = find_bundle(fp, entry); bundle && bundle->find(entry))
+      return fp;
   }
   return {};
 }
 
 void Editor::set_text(std::filesystem::path path, std::string &&text) {
   filepath = path;
-  this->text = std::move(text);
+  assign_text(std::move(text));
+  format.clear();
+  outline.clear();
+  layout_rows();
+  cursor = 0;
+  scroll_y = scroll_target = 0.0f;
+  restore_row.reset();
+  mode = EditorMode::Insert;
+  // The text is what the file held when it was read. If the file grew
+  // since, the first check picks up the rest as an append.
+  mark_synced(this->text.size());
+  ++disk_generation;
+  is_checking_disk = is_disk_stale = false;
+  conflict.reset();
+
+  ++paste_generation;
+  is_pasting = false;
+  size_t generation = ++parse_generation;
+  is_parsing = true;
+  // The worker flattens its own snapshot, so opening a large file does not
+  // copy it on the main thread
+  auto parse = [this, generation, snap = snapshot()](std::stop_token) {
+    std::string text = snap.text.str();
+    Tokens tokens{};
+    Parser parser{text, tokens};
+    parser.parse_all();
+    tasks.post([this, generation, tokens = std::move(tokens),
+                headings = std::move(parser.outline)]() mutable {
+      apply_parsed(generation, std::move(tokens), std::move(headings));
+    });
+  };
+  tasks.run(TaskPriority::Interactive, std::move(parse));
+  update_title();
+}
+
+void Editor::restore(std::string &&text) {
+  assign_text(std::move(text));
+  mode = EditorMode::Insert;
   reparse();
   normalize_cursor();
   update_title();
 }
 
+void Editor::apply_parsed(size_t generation, Tokens &&tokens,
+                          std::vector<Heading> &&headings) {
+  if (generation != parse_generation)
+    return;
+  is_parsing = false;
+  format = std::move(tokens);
+  outline = std::move(headings);
+  // Rows laid out while parsing had no tokens
+  minimap.reset();
+  layout_rows();
+  update_imgs();
+  if (show_find) {
+    refresh_search();
+  }
+  normalize_cursor();
+  if (restore_row) {
+    restore_view(cursor, *restore_row);
+    restore_row.reset();
+  }
+}
+
+void Editor::restore_view(size_t cursor, size_t row) {
+  // The file may have changed since, so the cursor is kept in the text
+  // and off the middle of a character
+  cursor = std::min(cursor, text.size());
+  while (cursor > 0 && cursor < text.size() &&
+         (static_cast<unsigned char>(text[cursor]) & 0xC0) == 0x80)
+    --cursor;
+  this->cursor = cursor;
+  is_view_moved = true;
+  if (is_parsing) {
+    restore_row = row;
+    return;
+  }
+  row = std::min(row, row_heights.size() - 1);
+  scroll_y = scroll_target = float(row_heights.offset(row));
+}
+
+void Editor::go_to_line(size_t line) {
+  size_t pos{0};
+  for (size_t row = 0; row < line && pos < text.size(); ++row) {
+    size_t newline = text.find('\n', pos);
+    if (newline == std::string::npos)
+      break;
+    pos = newline + 1;
+  }
+  mode = EditorMode::Insert;
+  restore_view(pos, line);
+}
+
+void Editor::mark_synced(uint64_t size) {
+  disk_base = snapshot();
+  disk_size = size;
+  disk_tail = text.substr(text.size() - std::min(text.size(), disk_tail_bytes));
+  compared_version = UINT64_MAX;
+}
+
+void Editor::set_disk_text(std::string_view contents, uint64_t size) {
+  // Never equal to a document version, so unsaved edits are found by
+  // comparing the text
+  disk_base = {UINT64_MAX, Rope(contents)};
+  disk_size = size;
+  disk_tail = contents.substr(contents.size() -
+                              std::min(contents.size(), disk_tail_bytes));
+  compared_version = UINT64_MAX;
+}
+
+// Reads only what follows `size` if the file grew past it with `tail`
+// still ending the old contents, and all of it otherwise
+static std::optional<DiskChange> read_disk_change(
+    const std::filesystem::path &fp, uint64_t size, std::string_view tail) {
+  std::ifstream fs(fp, std::ios::binary);
+  if (!fs)
+    return std::nullopt;
+  fs.seekg(0, std::ios::end);
+  uint64_t end = static_cast<uint64_t>(fs.tellg());
+  DiskChange change{};
+  if (end > size && size >= tail.size()) {
+    uint64_t from = size - tail.size();
+    std::string bytes(end - from, '\0');
+    fs.seekg(from);
+    fs.read(bytes.data(), bytes.size());
+    if (fs && std::string_view(bytes).starts_with(tail)) {
+      std::string_view added = std::string_view(bytes).substr(tail.size());
+      // A writer may be midway through a character or a CRLF; the rest
+      // comes with its next write
+      size_t len = added.size();
+      if (len > 0 && added[len - 1] == '\r')
+        --len;
+      size_t lead = len;
+      while (lead > 0 && len - lead < 4 &&
+             (static_cast<unsigned char>(added[lead - 1]) & 0xC0) == 0x80)
+        --lead;
+      if (lead > 0 && utf8_valid_len(added.substr(0, len), lead - 1) == 0 &&
+          len - lead < 3)
+        len = lead - 1;
+      change.is_append = true;
+      change.text = normalize_text(added.substr(0, len));
+      change.size = size + len;
+      return change;
+    }
+    fs.clear();
+  }
+  std::string bytes(end, '\0');
+  fs.seekg(0);
+  fs.read(bytes.data(), bytes.size());
+  if (!fs)
+    return std::nullopt;
+  change.text = normalize_text(bytes);
+  change.size = end;
+  return change;
+}
+
+void Editor::check_disk() {
+  if (filepath.empty() || is_example())
+    return;
+  if (is_checking_disk) {
+    is_disk_stale = true;
+    return;
+  }
+  is_checking_disk = true;
+  bool has_edits = is_save_needed();
+  auto work = [this, generation = disk_generation, fp = filepath,
+               size = disk_size, tail = disk_tail, base = disk_base,
+               mine = snapshot(), has_edits](std::stop_token) {
+    std::optional<DiskChange> change = read_disk_change(fp, size, tail);
+    if (change && !change->is_append) {
+      change->version = mine.version;
+      change->is_same = base.text.equals(change->text);
+      if (has_edits && !change->is_same) {
+        std::string base_text = base.text.str();
+        std::string mine_text = mine.text.str();
+        change->diff = diff_lines(mine_text, change->text);
+        change->merged = merge_lines(base_text, mine_text, change->text);
+      }
+    }
+    tasks.post([this, generation,
+                change = std::move(change)]() mutable {
+      apply_disk_change(generation, std::move(change));
+    });
+  };
+  tasks.run(TaskPriority::Background, std::move(work));
+}
+
+void Editor::apply_disk_change(size_t generation,
+                               std::optional<DiskChange> &&change) {
+  // Another file was opened meanwhile
+  if (generation != disk_generation)
+    return;
+  is_checking_disk = false;
+  if (is_disk_stale) {
+    is_disk_stale = false;
+    check_disk();
+    return;
+  }
+  if (!change)
+    return;
+  if (change->is_append) {
+    append_from_disk(std::move(*change));
+  } else if (change->is_same) {
+    disk_size = change->size;
+  } else if (change->version != document.get_version()) {
+    // Edited while the file was read; compare against the new text
+    check_disk();
+  } else if (!is_save_needed()) {
+    reload_text(std::move(change->text));
+    mark_synced(change->size);
+  } else {
+    conflict = std::move(change);
+    show_conflict = true;
+  }
+  update_title();
+}
+
+void Editor::append_from_disk(DiskChange &&change) {
+  if (change.text.empty())
+    return;
+  bool had_edits = is_save_needed();
+  // The view follows the end like `tail -f` only if the cursor was there
+  bool is_following = cursor == text.size();
+  size_t old_cursor = cursor;
+  float old_scroll = scroll_target;
+  Rope appended = disk_base.text.insert(disk_base.text.size(), change.text);
+  std::string tail = disk_tail + change.text;
+  ParsedEdit edit{};
+  edit.start = edit.end = text.size();
+  edit.text = std::move(change.text);
+  splice(std::move(edit));
+  if (!is_following) {
+    cursor = old_cursor;
+    scroll_target = old_scroll;
+  }
+  if (!had_edits) {
+    mark_synced(change.size);
+    return;
+  }
+  disk_base = {UINT64_MAX, std::move(appended)};
+  disk_size = change.size;
+  disk_tail = tail.substr(tail.size() - std::min(tail.size(), disk_tail_bytes));
+  compared_version = UINT64_MAX;
+}
+
+void Editor::reload_text(std::string &&new_text) {
+  // Only the span between the common start and end is replaced, so only
+  // the lines it covers are parsed again
+  std::string_view a{text}, b{new_text};
+  size_t head{0};
+  while (head < a.size() && head < b.size() && a[head] == b[head])
+    ++head;
+  size_t tail{0};
+  while (tail < a.size() - head && tail < b.size() - head &&
+         a[a.size() - 1 - tail] == b[b.size() - 1 - tail])
+    ++tail;
+  // Both ends kept off the middle of a character
+  auto is_inside = [](std::string_view s, size_t pos) {
+    return pos < s.size() &&
+           (static_cast<unsigned char>(s[pos]) & 0xC0) == 0x80;
+  };
+  while (head > 0 && (is_inside(a, head) || is_inside(b, head)))
+    --head;
+  while (tail > 0 && is_inside(a, a.size() - tail))
+    --tail;
+  size_t start = head, end = a.size() - tail;
+  size_t added = b.size() - tail - head;
+
+  size_t old_cursor = cursor;
+  if (old_cursor >= end)
+    old_cursor = old_cursor - end + start + added;
+  else if (old_cursor > start)
+    old_cursor = start;
+  float old_scroll = scroll_target;
+  if (added + (end - start) >= async_paste_bytes) {
+    // Too much to parse between frames
+    size_t row = top_row();
+    set_text(filepath, std::move(new_text));
+    restore_view(old_cursor, row);
+    return;
+  }
+  ParsedEdit edit{};
+  edit.start = start;
+  edit.end = end;
+  edit.text = std::string(b.substr(head, added));
+  splice(std::move(edit));
+  cursor = std::min(old_cursor, text.size());
+  select_anchor = std::min(select_anchor, text.size());
+  scroll_target = old_scroll;
+}
+
+void Editor::render_conflict() {
+  if (show_conflict) {
+    ImGui::OpenPopup("Changed on disk");
+    show_conflict = false;
+  }
+  ImGui::SetNextWindowSize({640.0f, 420.0f}, ImGuiCond_Appearing);
+  if (!ImGui::BeginPopupModal("Changed on disk"))
+    return;
+  if (!conflict) {
+    ImGui::CloseCurrentPopup();
+    ImGui::EndPopup();
+    return;
+  }
+  ImGui::TextWrapped("%s was changed by another program while it had "
+                     "unsaved edits.",
+                     filepath.filename().string().c_str());
+  // What the text becomes, if anything. The file as it is now is what
+  // later changes are measured against, whichever is picked.
+  std::optional<std::string> resolved{};
+  bool is_resolved{false};
+  if (conflict->merged) {
+    if (ImGui::Button("Merge")) {
+      resolved = std::move(conflict->merged);
+      is_resolved = true;
+    }
+    ImGui::SameLine();
+  }
+  if (ImGui::Button("Reload")) {
+    resolved = conflict->text;
+    is_resolved = true;
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Keep mine"))
+    is_resolved = true;
+  ImGui::TextDisabled("%s", conflict->merged
+                                ? "Changes from the open text to the file"
+                                : "Changes from the open text to the file; "
+                                  "they overlap yours, so they cannot be "
+                                  "merged");
+
+  ImGui::BeginChild("Diff", ImVec2(0, 0), true);
+  render_diff(conflict->diff);
+  ImGui::EndChild();
+
+  if (is_resolved) {
+    DiskChange change = std::move(*conflict);
+    conflict.reset();
+    if (resolved)
+      reload_text(std::move(*resolved));
+    set_disk_text(change.text, change.size);
+    update_title();
+    ImGui::CloseCurrentPopup();
+  }
+  ImGui::EndPopup();
+}
+
+size_t Editor::texture_bytes() {
+  size_t total{0};
+  for (auto &pair : images) {
+    float w, h;
+    if (SDL_GetTextureSize(reinterpret_cast<SDL_Texture *>(pair.second), &w,
+                           &h))
+      total += static_cast<size_t>(w * h * 4);
+  }
+  return total;
+}
+
+void Editor::trim() {
+  minimap.trim();
+  if (images.empty())
+    return;
+  for (auto &pair : images) {
+    SDL_DestroyTexture(reinterpret_cast<SDL_Texture *>(pair.second));
+  }
+  images.clear();
+  image_textures.clear();
+  images_trimmed = true;
+}
+
 void Editor::error_msg(std::string err) {
   error = err;
   show_error = true;
@@ -927,50 +1943,68 @@ void Editor::save() {
     } else {
       error_msg("Failed to save file!");
     }
+    return;
   }
   fs << text;
   fs.flush();
+  bool is_written = fs.good();
   fs.close();
+  if (is_written) {
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(filepath, ec);
+    mark_synced(ec ? text.size() : size);
+    // A check already reading the file may have seen it half written
+    if (is_checking_disk)
+      is_disk_stale = true;
+  } else {
+    error_msg("Failed to save file!");
+  }
   update_title();
+  // Only a file that was written is indexed and recorded as a revision
+  if (is_written && save_evt)
+    save_evt(filepath);
 }
 
+void Editor::on_save(Editor::save_event_fn fn) { save_evt = fn; }
+
 void Editor::normalize_cursor() {
   if (cursor > text.size()) {
     cursor = text.size();
   }
   size_t row = std::count(text.begin(), text.begin() + cursor, '\n');
-  if (row > row_max) {
-    row_start += row - row_max;
-  } else if (row < row_start) {
-    row_start = row;
-  }
+  if (row >= row_heights.size())
+    return;
+  // Keeps the cursor's row in view, its top edge first if it is taller
+  // than the view
+  float top = float(row_heights.offset(row));
+  float bottom = top + row_heights.get(row);
+  if (bottom > scroll_target + view_h)
+    scroll_target = bottom - view_h;
+  if (top < scroll_target)
+    scroll_target = top;
 }
 
-Token Editor::get_hovered_token() {
+int Editor::get_hovered_format() {
   size_t idx{0};
-  for (auto &token : format) {
-    if (std::holds_alternative<NewLine>(token)) {
-      ++idx;
-    } else if (std::holds_alternative<FormattedString>(token)) {
-      idx += std::get<FormattedString>(token).value.size();
-    } else if (std::holds_alternative<Image>(token)) {
-      // None
-    }
+  for (size_t i = 0; i < format.size(); ++i) {
+    idx += format.advance(i);
     if (idx >= cursor) {
-      return token;
+      return format.formats[i];
     }
   }
-  return format.size() == 0 ? Token{NewLine{}} : format.back();
+  return format.empty() ? 0 : format.formats[format.size() - 1];
 }
 
+// Rounded to whole pixels, so headings share baked glyphs with any other
+// text drawn at their size
 float apply_head(float fsize, int head_n) {
   switch (head_n & (Format_Head1 | Format_Head2 | Format_Head3)) {
   case Format_Head1:
-    return 2 * fsize;
+    return std::round(2 * fsize);
   case Format_Head2:
-    return 1.6 * fsize;
+    return std::round(1.6f * fsize);
   case Format_Head3:
-    return 1.2 * fsize;
+    return std::round(1.2f * fsize);
   default:
     return fsize;
   }
@@ -983,15 +2017,24 @@ bool Editor::is_save_needed() {
     return true;
   }
 
-  std::string contents{read_file_text(filepath)};
-
-  return contents != text;
+  // The file watcher reports changes on disk, so this compares against
+  // the text as last read or written instead of reading the file
+  uint64_t version = document.get_version();
+  if (version != compared_version) {
+    compared_version = version;
+    is_changed = version != disk_base.version && !disk_base.text.equals(text);
+  }
+  return is_changed;
 }
 
 void Editor::update_title() {
-  std::string save{is_save_needed() ? "*" : ""};
+  unsaved = is_save_needed();
+  std::string save{unsaved ? "*" : ""};
   std::string fp{filepath.empty() ? "(No file)" : filepath.string()};
   std::string title{save + "Take Notes - " + fp};
+  // Cached here so drawing the tab bar does not build strings every frame
+  tab_label = filepath.empty() ? "(No file)" : filepath.filename().string();
+  tab_label += "###" + std::to_string(reinterpret_cast<uintptr_t>(this));
   SDL_SetWindowTitle(window, title.c_str());
 }
 
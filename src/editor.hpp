@@ -1,17 +1,50 @@
 #pragma once
+#include "document.hpp"
 #include "file_exp.hpp"
+#include "frame_arena.hpp"
+#include "highlight.hpp"
+#include "line_heights.hpp"
 #include "markup.hpp"
+#include "minimap.hpp"
+#include "revisions.hpp"
+#include "search.hpp"
+#include "task_pool.hpp"
+#include "text_stats.hpp"
 #include <SDL3/SDL.h>
+#include <atomic>
 #include <filesystem>
+#include <functional>
 #include <imgui.h>
+#include <memory>
+#include <optional>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 enum class EditorMode { Insert, Select };
 
+// The file as another program left it, read on the task pool. An append
+// carries only the new text. A rewrite under unsaved edits also carries
+// the diff from the open text at `version` and, if the two sets of
+// changes touch different lines, both merged.
+struct DiskChange {
+  bool is_append{false}, is_same{false};
+  std::string text{};
+  uint64_t size{0}, version{0};
+  std::vector<DiffLine> diff{};
+  std::optional<std::string> merged{};
+};
+
 class Editor {
-  std::vector<Token> format{};
+  using save_event_fn = std::function<void(std::filesystem::path)>;
+  save_event_fn save_evt = 0;
+  Tokens format{};
+  std::vector<Heading> outline{};
+  bool show_outline{false};
+  // Flat copy that parsing and drawing index into. Every edit goes through
+  // insert_text, erase_text or assign_text so `document` stays in step.
   std::string text{};
+  Document document{};
   std::filesystem::path filepath{};
   size_t cursor{0};
   EditorMode mode{EditorMode::Insert};
@@ -20,32 +53,127 @@ class Editor {
   bool show_error{false};
   bool ask_save{false};
   FileExplorer save_explorer{std::filesystem::current_path()};
-  size_t row_start{0}, row_max{std::numeric_limits<size_t>().max()};
+  // Pixels from the top of the document, eased toward `scroll_target`
+  float scroll_y{0.0f}, scroll_target{0.0f};
+  // Where the last frame drew, for scrolling between frames
+  float view_h{0.0f}, layout_w{0.0f}, layout_size{0.0f}, char_w{0.0f};
+  // Left edge of the minimap and scrollbar; clicks past it do not move
+  // the cursor
+  float gutter_x{std::numeric_limits<float>().max()}, scroll_grab{0.0f};
+  LineHeights row_heights{};
+  // Height of each row as last drawn, 0 until it has been. Edits keep it
+  // aligned with the rows of `text`.
+  std::vector<float> measured{0.0f};
+  // First token and first image of each row
+  std::vector<uint32_t> row_tokens{0}, row_images{0};
+  Minimap minimap{};
+  bool show_minimap{true};
+  CodeHighlighter highlighter{};
+  // Counts shown in the status bar. Text counts follow each edit; the
+  // structure is counted when rows are laid out.
+  TextStats stats{};
+  size_t table_count{0};
+  // The selection's counts, kept until it or the document changes
+  TextCounts selection_counts{};
+  size_t selection_start{0}, selection_end{0};
+  uint64_t selection_version{UINT64_MAX};
   bool do_cursor_choose{false};
   int choose_x{0}, choose_y{0};
   std::unordered_map<std::filesystem::path, ImTextureID> images{};
+  // Path and texture of each Image token, in document order
+  std::vector<std::filesystem::path> image_paths{};
+  std::vector<ImTextureID> image_textures{};
+  FrameArena frame_arena{};
+  bool images_trimmed{false};
+  // Images being decoded on the task pool
+  std::unordered_set<std::filesystem::path> decoding{};
+  bool unsaved{false};
+  std::string tab_label{};
+  // Parses started by set_text finish on the task pool and are applied at
+  // the next drain. Any edit in the meantime bumps the generation, which
+  // discards the stale result.
+  size_t parse_generation{0};
+  bool is_parsing{false};
+  // Row a restored session scrolls to once the parse lays rows out
+  std::optional<size_t> restore_row{};
+  // Pastes this large are normalized and parsed on the task pool, with
+  // their progress shown until they land
+  static constexpr size_t async_paste_bytes = size_t(1) << 20;
+  size_t paste_generation{0};
+  bool is_pasting{false};
+  size_t paste_total{0};
+  std::shared_ptr<std::atomic<size_t>> paste_progress{};
+  // The file as last read or written, which unsaved changes and changes
+  // on disk are both measured against. Its last bytes tell an append from
+  // a rewrite without reading the rest of the file.
+  static constexpr size_t disk_tail_bytes = 64;
+  DocumentSnapshot disk_base{};
+  uint64_t disk_size{0};
+  std::string disk_tail{};
+  // Whether the text differs from `disk_base`, as of a document version
+  uint64_t compared_version{UINT64_MAX};
+  bool is_changed{false};
+  // One check of the file runs at a time; a change seen meanwhile runs
+  // another once it lands
+  size_t disk_generation{0};
+  bool is_checking_disk{false}, is_disk_stale{false};
+  std::optional<DiskChange> conflict{};
+  bool show_conflict{false};
+  Search search{};
+  bool show_find{false}, find_focus{false};
+  std::string find_input{}, replace_input{};
 
+  void insert_text(size_t pos, std::string_view str);
+  void erase_text(size_t pos, size_t len);
+  void assign_text(std::string &&str);
+  void layout_rows();
+  void scroll_to(float offset);
+  float max_scroll();
   void normalize_cursor();
   void select_erase_exit();
   void reparse();
+  void apply_parsed(size_t generation, Tokens &&tokens,
+                    std::vector<Heading> &&headings);
+  void paste();
+  void copy_selection();
+  void apply_edit(ParsedEdit &&edit);
+  void splice(ParsedEdit &&edit);
+  void mark_synced(uint64_t size);
+  void set_disk_text(std::string_view contents, uint64_t size);
+  void apply_disk_change(size_t generation, std::optional<DiskChange> &&change);
+  void append_from_disk(DiskChange &&change);
+  void reload_text(std::string &&new_text);
+  void render_conflict();
   void update_imgs();
+  void resolve_imgs();
   void error_msg(std::string err);
   void save();
-  Token get_hovered_token();
+  int get_hovered_format();
   std::filesystem::path get_path_proper(std::filesystem::path img_fp);
+  void render_find();
+  void render_outline();
+  void refresh_search();
+  void find_step(bool forward);
+  void replace_matches();
 
 public:
-  float width{0.8f}, height{1.0f}, font_size{18.0f};
+  float width{0.8f}, height{1.0f}, font_size{18.0f}, top{0.0f};
   ImFont *plain, *bold;
   SDL_Window *window;
   SDL_Renderer *renderer;
   bool is_focused{false};
+  // Set when the file, cursor or scroll position changes; Tabs takes it
+  // up for the session
+  bool is_view_moved{false};
   std::filesystem::path example_file{};
   Editor(SDL_Window *window, SDL_Renderer *renderer, ImFont *plain,
          ImFont *bold)
       : plain(plain), bold(bold), window(window), renderer(renderer) {
-    save_explorer.on_open([&](auto fp, auto &&) {
+    find_input.resize(1024);
+    replace_input.resize(1024);
+    save_explorer.on_open([&](auto fp, auto &&, auto) {
       filepath = fp;
+      is_view_moved = true;
       ask_save = false;
       save();
     });
@@ -60,11 +188,40 @@ public:
   void event(const SDL_Event &event);
   void render();
   void set_text(std::filesystem::path path, std::string &&text);
+  // Replaces the contents as an edit, keeping the file and cursor
+  void restore(std::string &&text);
+  // O(1), and safe to read from any thread
+  DocumentSnapshot snapshot() const { return document.snapshot(); }
   void update_title();
+  void on_save(save_event_fn event);
   bool is_save_needed();
+  bool is_unsaved() { return unsaved; }
+  bool is_loading() { return is_parsing; }
+  size_t token_count() { return format.size(); }
   bool is_example();
+  bool is_blank() { return filepath.empty() && text.empty(); }
+  const std::filesystem::path &get_filepath() { return filepath; }
+  size_t get_cursor() { return cursor; }
+  // First row in view
+  size_t top_row() { return row_heights.find(scroll_y); }
+  // Puts back the cursor and scroll position a session recorded
+  void restore_view(size_t cursor, size_t row);
+  // Puts the cursor at the start of a line and scrolls it to the top
+  void go_to_line(size_t line);
+  // Picks up what another program wrote to the file. Appends go in at the
+  // end like `tail -f`; a rewrite reloads the text, or asks what to do if
+  // there are unsaved edits.
+  void check_disk();
+  const std::string &get_tab_label() { return tab_label; }
+  size_t texture_bytes();
+  void trim();
 
   ImVec4 get_bg_rect();
 
   ~Editor();
+
+private:
+  // Last, so running tasks finish before the state they write to is
+  // destroyed
+  TaskGroup tasks{};
 };
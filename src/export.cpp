@@ -0,0 +1,515 @@
+#include "export.hpp"
+#include "markup.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+std::optional<ExportFormat> parse_export_format(std::string_view name) {
+  if (name == "html")
+    return ExportFormat::Html;
+  if (name == "md")
+    return ExportFormat::Markdown;
+  return std::nullopt;
+}
+
+// Images already copied to the output. Notes exported in parallel can
+// share an image, and only the first to claim its destination copies it.
+class ImageCopies {
+  std::mutex mtx{};
+  std::unordered_set<std::string> claimed{};
+
+public:
+  bool claim(const std::filesystem::path &dst) {
+    std::lock_guard lock{mtx};
+    return claimed.insert(dst.lexically_normal().generic_string()).second;
+  }
+};
+
+// Fixed-size buffer in front of the output file
+class Writer {
+  std::ofstream out;
+  std::array<char, 1 << 16> buf{};
+  size_t used{0};
+
+public:
+  Writer(const std::filesystem::path &fp)
+      : out(fp, std::ios::binary | std::ios::trunc) {}
+  ~Writer() { flush(); }
+
+  bool is_open() { return out.is_open(); }
+  bool finish() {
+    flush();
+    out.flush();
+    return out.good();
+  }
+
+  void flush() {
+    out.write(buf.data(), used);
+    used = 0;
+  }
+
+  void put(char c) {
+    if (used == buf.size())
+      flush();
+    buf[used++] = c;
+  }
+
+  void write(std::string_view s) {
+    if (s.size() > buf.size() - used) {
+      flush();
+      if (s.size() >= buf.size()) {
+        out.write(s.data(), s.size());
+        return;
+      }
+    }
+    std::memcpy(buf.data() + used, s.data(), s.size());
+    used += s.size();
+  }
+};
+
+enum class Block { None, Paragraph, Heading, List, Code, Table };
+
+static constexpr int inline_formats[] = {Format_Bold, Format_Italic,
+                                         Format_Strike};
+
+// Walks the tokens line by line, grouping consecutive lines of the same
+// kind into one block
+class NoteWriter {
+  Writer &out;
+  ExportFormat format;
+  std::string_view text;
+  const Tokens &tokens;
+  std::filesystem::path note_dir, out_dir;
+  ImageCopies &copies;
+
+  Block block{Block::None};
+  bool has_written{false};
+  size_t block_lines{0};
+  int open_inline{0};
+
+  Block classify(size_t begin, size_t end, int &level) {
+    for (size_t i = begin; i < end; ++i) {
+      if (tokens.is_text(i) && tokens.lens[i] == 0)
+        continue;
+      int fmt = tokens.formats[i];
+      if (fmt & Format_Code)
+        return Block::Code;
+      if (fmt & Format_Table)
+        return Block::Table;
+      if (fmt & Format_Marker && fmt & Format_List)
+        return Block::List;
+      if (fmt & Format_Marker &&
+          fmt & (Format_Head1 | Format_Head2 | Format_Head3)) {
+        level = static_cast<int>(tokens.lens[i]);
+        return Block::Heading;
+      }
+      return Block::Paragraph;
+    }
+    return Block::None;
+  }
+
+  void escaped(std::string_view s) {
+    for (char c : s) {
+      if (format == ExportFormat::Html) {
+        switch (c) {
+        case '&':
+          out.write("&amp;");
+          break;
+        case '<':
+          out.write("&lt;");
+          break;
+        case '>':
+          out.write("&gt;");
+          break;
+        case '"':
+          out.write("&quot;");
+          break;
+        default:
+          out.put(c);
+        }
+      } else {
+        if (std::strchr("\\`*_[]<>#~|", c))
+          out.put('\\');
+        out.put(c);
+      }
+    }
+  }
+
+  void set_inline(int fmt) {
+    static const char *html_open[] = {"<strong>", "<em>", "<del>"};
+    static const char *html_close[] = {"</strong>", "</em>", "</del>"};
+    static const char *md_marks[] = {"**", "*", "~~"};
+    bool is_html = format == ExportFormat::Html;
+    if (fmt == open_inline)
+      return;
+    // Closing everything and reopening keeps the tags properly nested
+    for (int i = 2; i >= 0; --i) {
+      if (open_inline & inline_formats[i])
+        out.write(is_html ? html_close[i] : md_marks[i]);
+    }
+    for (int i = 0; i < 3; ++i) {
+      if (fmt & inline_formats[i])
+        out.write(is_html ? html_open[i] : md_marks[i]);
+    }
+    open_inline = fmt;
+  }
+
+  std::string image_link(std::string_view raw) {
+    std::filesystem::path fp{std::string(raw)};
+    std::filesystem::path src = fp.is_absolute() ? fp : note_dir / fp;
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(src, ec))
+      return fp.generic_string();
+    std::filesystem::path rel = fp.lexically_normal();
+    if (fp.is_absolute() || rel.empty() || *rel.begin() == "..") {
+      // Outside the note's folder; link it where it is
+      return std::filesystem::absolute(src, ec).generic_string();
+    }
+    std::filesystem::path dst = out_dir / rel;
+    if (copies.claim(dst)) {
+      std::filesystem::create_directories(dst.parent_path(), ec);
+      std::filesystem::copy_file(
+          src, dst, std::filesystem::copy_options::update_existing, ec);
+    }
+    return rel.generic_string();
+  }
+
+  void image(std::string_view raw) {
+    std::string link = image_link(raw);
+    if (format == ExportFormat::Html) {
+      out.write("<img src=\"");
+      escaped(link);
+      out.write("\" alt=\"");
+      escaped(raw);
+      out.write("\">");
+    } else {
+      out.write("![");
+      escaped(raw);
+      out.write("](<");
+      out.write(link);
+      out.write(">)");
+    }
+  }
+
+  // Inline content of a line, skipping markup characters
+  void inline_run(size_t begin, size_t end) {
+    bool at_start{true};
+    for (size_t i = begin; i < end; ++i) {
+      if (tokens.is_image(i)) {
+        image(tokens.view(text, i));
+        continue;
+      }
+      int fmt = tokens.formats[i];
+      // The bracketed source of an image is followed by the image itself
+      if (fmt & Format_Marker || (i + 1 < end && tokens.is_image(i + 1)))
+        continue;
+      std::string_view s = tokens.view(text, i);
+      // Escapes are the only runs that start with a backslash
+      if (s.size() > 1 && s[0] == '\\')
+        s.remove_prefix(1);
+      if (at_start) {
+        while (!s.empty() && s[0] == ' ')
+          s.remove_prefix(1);
+        if (s.empty())
+          continue;
+        at_start = false;
+      }
+      set_inline(fmt & (Format_Bold | Format_Italic | Format_Strike));
+      escaped(s);
+    }
+    set_inline(0);
+  }
+
+  void table_row(size_t begin, size_t end) {
+    bool is_html = format == ExportFormat::Html;
+    bool is_head = block_lines == 0;
+    size_t cols{0};
+    out.write(is_html ? "<tr>" : "|");
+    // Cells sit between the pipe markers, possibly empty
+    for (size_t i = begin; i < end; ++i) {
+      if (tokens.formats[i] & Format_Marker)
+        continue;
+      ++cols;
+      std::string_view cell = tokens.view(text, i);
+      if (is_html) {
+        out.write(is_head ? "<th>" : "<td>");
+        escaped(cell);
+        out.write(is_head ? "</th>" : "</td>");
+      } else {
+        out.put(' ');
+        escaped(cell);
+        out.write(" |");
+      }
+    }
+    out.write(is_html ? "</tr>\n" : "\n");
+    if (is_head && !is_html) {
+      out.put('|');
+      for (size_t c = 0; c < cols; ++c)
+        out.write(" --- |");
+      out.put('\n');
+    }
+  }
+
+  void close_block() {
+    bool is_html = format == ExportFormat::Html;
+    switch (block) {
+    case Block::None:
+      return;
+    case Block::Paragraph:
+      out.write(is_html ? "</p>\n" : "\n");
+      break;
+    case Block::Heading:
+      break;
+    case Block::List:
+      if (is_html)
+        out.write("</ul>\n");
+      break;
+    case Block::Code:
+      out.write(is_html ? "</code></pre>\n" : "```\n");
+      break;
+    case Block::Table:
+      if (is_html)
+        out.write("</table>\n");
+      break;
+    }
+    block = Block::None;
+  }
+
+  void open_block(Block next) {
+    bool is_html = format == ExportFormat::Html;
+    if (has_written && !is_html)
+      out.put('\n');
+    has_written = true;
+    block = next;
+    block_lines = 0;
+    switch (next) {
+    case Block::Paragraph:
+      if (is_html)
+        out.write("<p>");
+      break;
+    case Block::List:
+      if (is_html)
+        out.write("<ul>\n");
+      break;
+    case Block::Code:
+      out.write(is_html ? "<pre><code>" : "```\n");
+      break;
+    case Block::Table:
+      if (is_html)
+        out.write("<table>\n");
+      break;
+    default:
+      break;
+    }
+  }
+
+  void line(size_t begin, size_t end) {
+    bool is_html = format == ExportFormat::Html;
+    int level{0};
+    Block kind = classify(begin, end, level);
+    if (kind != block || kind == Block::Heading)
+      close_block();
+    if (kind == Block::None)
+      return;
+    if (block == Block::None)
+      open_block(kind);
+
+    switch (kind) {
+    case Block::Paragraph:
+      if (block_lines > 0)
+        out.write(is_html ? "<br>\n" : "\\\n");
+      inline_run(begin, end);
+      break;
+    case Block::Heading:
+      if (is_html) {
+        out.write("<h");
+        out.put('0' + level);
+        out.put('>');
+        inline_run(begin, end);
+        out.write("</h");
+        out.put('0' + level);
+        out.write(">\n");
+      } else {
+        out.write(std::string_view{"###"}.substr(0, level));
+        out.put(' ');
+        inline_run(begin, end);
+        out.put('\n');
+      }
+      break;
+    case Block::List:
+      out.write(is_html ? "<li>" : "- ");
+      inline_run(begin, end);
+      out.write(is_html ? "</li>\n" : "\n");
+      break;
+    case Block::Code:
+      for (size_t i = begin; i < end; ++i) {
+        if (!(tokens.formats[i] & Format_Code))
+          continue;
+        // Drop the tab that starts the line
+        std::string_view code = tokens.view(text, i).substr(1);
+        if (is_html) {
+          if (block_lines > 0)
+            out.put('\n');
+          escaped(code);
+        } else {
+          out.write(code);
+          out.put('\n');
+        }
+      }
+      break;
+    case Block::Table:
+      table_row(begin, end);
+      break;
+    case Block::None:
+      break;
+    }
+    ++block_lines;
+  }
+
+public:
+  NoteWriter(Writer &out, ExportFormat format, std::string_view text,
+             const Tokens &tokens, std::filesystem::path note_dir,
+             std::filesystem::path out_dir, ImageCopies &copies)
+      : out(out), format(format), text(text), tokens(tokens),
+        note_dir(std::move(note_dir)), out_dir(std::move(out_dir)),
+        copies(copies) {}
+
+  void write(std::string_view title) {
+    if (format == ExportFormat::Html) {
+      out.write("<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n"
+                "<title>");
+      escaped(title);
+      out.write("</title>\n</head>\n<body>\n");
+    }
+    size_t begin{0};
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      if (tokens.is_newline(i)) {
+        line(begin, i);
+        begin = i + 1;
+      }
+    }
+    line(begin, tokens.size());
+    close_block();
+    if (format == ExportFormat::Html)
+      out.write("</body>\n</html>\n");
+  }
+};
+
+// Files with a NUL byte near the start are assets, not notes
+static bool is_binary(const std::filesystem::path &fp) {
+  std::ifstream fs(fp, std::ios::binary);
+  std::array<char, 8192> head{};
+  fs.read(head.data(), head.size());
+  return std::find(head.begin(), head.begin() + fs.gcount(), '\0') !=
+         head.begin() + fs.gcount();
+}
+
+static bool export_note(const std::filesystem::path &in,
+                        const std::filesystem::path &out,
+                        ExportFormat format, ImageCopies &copies) {
+  std::error_code ec;
+  std::string text{read_file_text(in, ec)};
+  if (ec)
+    return false;
+  Tokens tokens{};
+  Parser parser{text, tokens};
+  parser.parse_all();
+
+  if (out.has_parent_path())
+    std::filesystem::create_directories(out.parent_path(), ec);
+  Writer writer{out};
+  if (!writer.is_open())
+    return false;
+  NoteWriter note{writer, format, text, tokens, in.parent_path(),
+                  out.parent_path(), copies};
+  note.write(in.stem().string());
+  return writer.finish();
+}
+
+static const char *extension(ExportFormat format) {
+  return format == ExportFormat::Html ? ".html" : ".md";
+}
+
+size_t export_notes(const std::filesystem::path &in,
+                    const std::filesystem::path &out, ExportFormat format) {
+  ImageCopies copies{};
+  std::error_code ec;
+  if (!std::filesystem::is_directory(in, ec)) {
+    std::filesystem::path dst = out;
+    if (std::filesystem::is_directory(out, ec))
+      dst = out / in.filename().replace_extension(extension(format));
+    if (!export_note(in, dst, format, copies)) {
+      std::fprintf(stderr, "Failed to export %s\n", in.string().c_str());
+      return 1;
+    }
+    return 0;
+  }
+
+  // Collected up front so the output tree, if it lies inside the input,
+  // is not picked up halfway through
+  std::filesystem::path out_abs = std::filesystem::weakly_canonical(out, ec);
+  std::vector<std::filesystem::path> files{};
+  auto it = std::filesystem::recursive_directory_iterator(
+      in, std::filesystem::directory_options::skip_permission_denied, ec);
+  for (auto end = std::filesystem::recursive_directory_iterator();
+       !ec && it != end; it.increment(ec)) {
+    // An error on one entry skips it; only the iterator's own errors end
+    // the walk
+    std::error_code entry_ec;
+    std::string name = it->path().filename().string();
+    bool is_dir = it->is_directory(entry_ec);
+    if ((!name.empty() && name[0] == '.') ||
+        (is_dir && std::filesystem::weakly_canonical(it->path(), entry_ec) ==
+                       out_abs)) {
+      if (is_dir)
+        it.disable_recursion_pending();
+      continue;
+    }
+    if (it->is_regular_file(entry_ec))
+      files.push_back(it->path());
+  }
+  size_t walk_failed{0};
+  if (ec) {
+    std::fprintf(stderr, "Failed to list %s: %s\n", in.string().c_str(),
+                 ec.message().c_str());
+    walk_failed = 1;
+  }
+
+  std::atomic<size_t> next{0}, done{0}, failed{0};
+  {
+    std::vector<std::jthread> workers{};
+    size_t n = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t w = 0; w < std::min(n, files.size()); ++w) {
+      workers.emplace_back([&]() {
+        for (size_t i = next++; i < files.size(); i = next++) {
+          const std::filesystem::path &fp = files[i];
+          // Images are only copied when a note uses them
+          if (is_binary(fp))
+            continue;
+          std::filesystem::path dst =
+              out / fp.lexically_relative(in).replace_extension(
+                        extension(format));
+          if (export_note(fp, dst, format, copies)) {
+            ++done;
+          } else {
+            std::fprintf(stderr, "Failed to export %s\n",
+                         fp.string().c_str());
+            ++failed;
+          }
+        }
+      });
+    }
+  }
+  std::printf("Exported %zu notes to %s\n", done.load(),
+              out.string().c_str());
+  return failed + walk_failed;
+}
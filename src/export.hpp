@@ -0,0 +1,17 @@
+#pragma once
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+enum class ExportFormat { Html, Markdown };
+
+// "html" or "md"
+std::optional<ExportFormat> parse_export_format(std::string_view name);
+
+// Converts a note to `out`, or every note under a directory into the same
+// tree below `out`, spread across all cores. Output is written through a
+// fixed buffer as the tokens are walked. Relative images are copied next
+// to the output, once each. Returns the number of files that failed, plus
+// one if the directory could not be walked to the end.
+size_t export_notes(const std::filesystem::path &in,
+                    const std::filesystem::path &out, ExportFormat format);
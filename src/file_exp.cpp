@@ -1,4 +1,5 @@
 #include "file_exp.hpp"
+#include "profiler.hpp"
 #include "utility.hpp"
 #include <algorithm>
 #include <fstream>
@@ -7,21 +8,110 @@
 
 FileExplorer::FileExplorer(const std::filesystem::path root) : root(root) {
   filename.resize(1024);
-  update_dir();
+  query.resize(1024);
 }
 
-void FileExplorer::update_dir() {
-  file_list.clear();
-  for (auto &entry : std::filesystem::directory_iterator(root)) {
-    file_list.emplace_back(entry.path());
+static void list_bundle(const std::filesystem::path &root,
+                        const NoteBundle &bundle, std::string_view prefix,
+                        DirListing &listing) {
+  // Entries are sorted, so everything below `prefix` is one run and each
+  // subfolder's entries are contiguous within it
+  std::string base{prefix};
+  if (!base.empty())
+    base += '/';
+  std::string_view last_dir{};
+  for (size_t i = bundle.lower_bound(base);
+       i < bundle.size() && bundle.name(i).starts_with(base); ++i) {
+    std::string_view rest = bundle.name(i).substr(base.size());
+    size_t slash = rest.find('/');
+    if (slash == rest.npos) {
+      listing.files.emplace_back(root / rest);
+      listing.dirs.push_back(false);
+    } else if (rest.substr(0, slash) != last_dir) {
+      last_dir = rest.substr(0, slash);
+      listing.files.emplace_back(root / last_dir);
+      listing.dirs.push_back(true);
+    }
+  }
+}
+
+static DirListing list_dir(const std::filesystem::path &root) {
+  DirListing listing{};
+  std::string prefix{};
+  if (auto bundle = find_bundle(root, prefix)) {
+    list_bundle(root, *bundle, prefix, listing);
+  } else {
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it{root, ec}, end{};
+         !ec && it != end; it.increment(ec)) {
+      listing.files.emplace_back(it->path());
+    }
+    std::sort(listing.files.begin(), listing.files.end());
+    for (auto &fp : listing.files) {
+      listing.dirs.push_back(std::filesystem::is_directory(fp, ec) ||
+                             fp.extension() == NoteBundle::extension);
+    }
+  }
+  for (auto &fp : listing.files) {
+    listing.names.emplace_back(fp.filename().string());
   }
-  std::sort(file_list.begin(), file_list.end());
+  return listing;
+}
+
+void FileExplorer::update_dir() {
+  root_label = root.string();
+  listed_root = root;
+  std::error_code ec;
+  listed_time = std::filesystem::last_write_time(root, ec);
+  // Only the newest listing is shown when several are in flight
+  size_t generation = ++list_generation;
+  is_listing = true;
+  tasks.run(TaskPriority::Interactive,
+            [this, root = root, generation](std::stop_token) {
+              auto listing = std::make_shared<DirListing>(list_dir(root));
+              tasks.post([this, listing, generation]() {
+                if (generation != list_generation)
+                  return;
+                this->listing = std::move(*listing);
+                is_listing = false;
+                has_listed = true;
+              });
+            });
 }
 
 void FileExplorer::on_open(FileExplorer::open_event_fn fn) { open_evt = fn; }
 
+std::optional<std::string> read_note(const std::filesystem::path &fp) {
+  std::string entry{};
+  if (auto bundle = find_bundle(fp, entry)) {
+    std::string scratch{};
+    std::optional<size_t> i = bundle->find(entry);
+    if (!i)
+      return std::nullopt;
+    if (auto contents = bundle->contents(*i, scratch))
+      return std::string(*contents);
+    return std::nullopt;
+  }
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(fp, ec))
+    return std::nullopt;
+  return read_file_text(fp);
+}
+
+void FileExplorer::open(const std::filesystem::path &fp,
+                        std::optional<size_t> line) {
+  if (auto contents = read_note(fp))
+    open_evt(fp, std::move(*contents), line);
+}
+
 void FileExplorer::render() {
-  update_dir();
+  PROFILE_ZONE("FileExplorer::render");
+  // Entries only change when the directory's own mtime does
+  std::error_code ec;
+  if (root != listed_root ||
+      std::filesystem::last_write_time(root, ec) != listed_time) {
+    update_dir();
+  }
 
   ImGui::Begin(title.c_str(), nullptr, flags);
   ImGui::SetWindowPos({x, y}, ImGuiCond_Once);
@@ -35,18 +125,18 @@ void FileExplorer::render() {
                     ImGuiWindowFlags_None);
 
   float avail = ImGui::GetContentRegionAvail().x;
-  float item_w = ImGui::CalcTextSize(root.string().c_str()).x +
+  float item_w = ImGui::CalcTextSize(root_label.c_str()).x +
                  ImGui::CalcTextSize("New File").x +
                  ImGui::GetStyle().ItemSpacing.x;
   auto new_file = [&]() { creating_file = true; };
   if (item_w <= avail) {
-    ImGui::Text("%s", root.string().c_str());
+    ImGui::Text("%s", root_label.c_str());
     ImGui::SameLine();
     if (ImGui::Button("New File")) {
       new_file();
     }
   } else {
-    ImGui::Text("%s", root.string().c_str());
+    ImGui::Text("%s", root_label.c_str());
     if (ImGui::Button("New File")) {
       new_file();
     }
@@ -54,22 +144,33 @@ void FileExplorer::render() {
 
   ImGui::Spacing();
 
+  if (index) {
+    render_search();
+    if (query[0] != '\0')
+      ImGui::Separator();
+  }
+
   if (root.has_parent_path() && ImGui::Button("..")) {
     root = root.parent_path();
+    is_session_dirty = true;
   }
 
   if (ImGui::IsKeyDown(ImGuiKey_Escape) && can_close) {
     is_closed = true;
   }
 
-  for (const auto &fp : file_list) {
-    if (ImGui::Button(fp.filename().string().c_str())) {
-      if (std::filesystem::is_regular_file(fp)) {
-        std::string contents{read_file_text(fp)};
-        open_evt(fp, std::move(contents));
-      }
-      if (std::filesystem::is_directory(fp)) {
+  if (is_listing && listing.files.empty()) {
+    ImGui::TextDisabled("%s", "Loading...");
+  }
+
+  for (size_t i = 0; i < listing.files.size(); ++i) {
+    const auto &fp = listing.files[i];
+    if (ImGui::Button(listing.names[i].c_str())) {
+      if (listing.dirs[i]) {
         root = fp;
+        is_session_dirty = true;
+      } else {
+        open(fp);
       }
     }
   }
@@ -98,8 +199,7 @@ void FileExplorer::render() {
     ImGui::SetCursorPosX(ImGui::GetCursorPosX() + pad);
     ImGui::SetCursorPosY(ImGui::GetCursorPosY() + (footer_h - button_h) / 2);
     if (ImGui::Button("See example document.", ImVec2(button_w, 0))) {
-      std::string contents{read_file_text(example_file)};
-      open_evt(example_file, std::move(contents));
+      open(example_file);
     }
     ImGui::EndGroup();
   }
@@ -107,6 +207,43 @@ void FileExplorer::render() {
   ImGui::End();
 }
 
+void FileExplorer::render_search() {
+  ImGui::InputText("Search", query.data(), query.size());
+
+  if (last_query != query.c_str() || last_generation != index->generation) {
+    last_query = query.c_str();
+    last_generation = index->generation;
+    hits = index->query(last_query);
+    hit_labels.clear();
+    std::filesystem::path index_root = index->get_root();
+    for (auto &hit : hits) {
+      hit_labels.push_back(hit.fp.lexically_relative(index_root).string() +
+                           ":" + std::to_string(hit.line + 1));
+    }
+  }
+
+  if (index->is_indexing) {
+    ImGui::TextDisabled("Indexing %zu/%zu", index->progress.load(),
+                        index->total.load());
+  }
+
+  if (last_query.empty())
+    return;
+
+  ImGui::PushID("Hits");
+  for (size_t i = 0; i < hits.size(); ++i) {
+    ImGui::PushID(i);
+    if (ImGui::Button(hit_labels[i].c_str())) {
+      open(hits[i].fp, hits[i].line);
+    }
+    ImGui::PopID();
+  }
+  if (hits.empty()) {
+    ImGui::TextDisabled("%s", "No matches");
+  }
+  ImGui::PopID();
+}
+
 void FileExplorer::create_file(std::string filename) {
   std::filesystem::path pt = root / filename;
   if (!std::filesystem::exists(pt.parent_path())) {
@@ -122,4 +259,6 @@ void FileExplorer::create_file(std::string filename) {
   ofs.close();
 
   update_dir();
+  if (index)
+    index->refresh();
 }
@@ -1,29 +1,75 @@
 #pragma once
+#include "bundle.hpp"
+#include "note_index.hpp"
+#include "task_pool.hpp"
 #include <filesystem>
 #include <functional>
 #include <imgui.h>
+#include <optional>
 #include <string>
 #include <vector>
 
+// Entries of one directory or bundle folder, sorted
+struct DirListing {
+  std::vector<std::filesystem::path> files{};
+  std::vector<std::string> names{};
+  // Directories, and bundles, which are browsed like one
+  std::vector<bool> dirs{};
+};
+
+// Contents of a file, or of a note inside a bundle. Safe on any thread.
+std::optional<std::string> read_note(const std::filesystem::path &fp);
+
+// Lists the directory at `root` on the task pool, so neither startup nor
+// browsing into a large folder waits on the file system. The previous
+// entries stay up until the new ones arrive.
 class FileExplorer {
   std::filesystem::path root;
-  std::vector<std::filesystem::path> file_list;
-  using open_event_fn =
-      std::function<void(std::filesystem::path, std::string &&)>;
+  DirListing listing{};
+  std::string root_label{};
+  // What the newest listing was started for
+  std::filesystem::path listed_root{};
+  std::filesystem::file_time_type listed_time{};
+  size_t list_generation{0};
+  bool is_listing{false}, has_listed{false};
+  // The file, its contents and the line to show, if any
+  using open_event_fn = std::function<void(
+      std::filesystem::path, std::string &&, std::optional<size_t>)>;
   open_event_fn open_evt = 0;
   bool creating_file{false};
   std::string filename;
+  std::string query{};
+  std::string last_query{};
+  size_t last_generation{0};
+  std::vector<IndexHit> hits{};
+  std::vector<std::string> hit_labels{};
+
+  void render_search();
 
 public:
   bool can_close{false}, is_closed{false};
   bool has_example{false};
+  // Set when browsing moves to another folder
+  bool is_session_dirty{false};
   std::filesystem::path example_file{};
+  NoteIndex *index{nullptr};
   float x, y, w, h;
   ImGuiWindowFlags flags{};
   std::string title{"Explorer"};
   FileExplorer(std::filesystem::path root);
   void render();
   void on_open(open_event_fn event);
+  void open(const std::filesystem::path &fp,
+            std::optional<size_t> line = std::nullopt);
+  const std::filesystem::path &get_root() { return root; }
+  // Browses to `root`; it is listed at the next render
+  void set_root(const std::filesystem::path &root) { this->root = root; }
+  // Starts listing `root` again; the entries change once it finishes
   void update_dir();
+  bool has_listing() const { return has_listed; }
   void create_file(std::string filename);
+
+private:
+  // Last, so a running listing finishes before the explorer goes away
+  TaskGroup tasks{};
 };
\ No newline at end of file
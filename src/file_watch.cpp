@@ -0,0 +1,119 @@
+#include "file_watch.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher() {
+#ifdef __linux__
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+  if (fd >= 0)
+    close(fd);
+#endif
+}
+
+void FileWatcher::watch(const std::vector<std::filesystem::path> &fps) {
+  std::vector<Watched> next{};
+  for (auto &fp : fps) {
+    if (std::ranges::any_of(next, [&](auto &w) { return w.fp == fp; }))
+      continue;
+    auto old = std::ranges::find(files, fp, &Watched::fp);
+    if (old != files.end()) {
+      next.push_back(std::move(*old));
+      continue;
+    }
+    Watched &w = next.emplace_back();
+    w.fp = fp;
+    w.name = fp.filename().string();
+    std::error_code ec;
+    w.mtime = std::filesystem::last_write_time(fp, ec);
+#ifdef __linux__
+    std::filesystem::path dir = fp.parent_path();
+    if (dir.empty())
+      dir = ".";
+    // Adding a directory again returns its existing watch
+    if (fd >= 0)
+      w.wd = inotify_add_watch(fd, dir.c_str(),
+                               IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO |
+                                   IN_CREATE);
+#endif
+  }
+#ifdef __linux__
+  // Directories none of the new files are in
+  for (auto &w : files) {
+    if (w.wd < 0 || std::ranges::find(next, w.wd, &Watched::wd) != next.end())
+      continue;
+    inotify_rm_watch(fd, w.wd);
+    for (auto &other : files) {
+      if (other.wd == w.wd)
+        other.wd = -1;
+    }
+  }
+#endif
+  files = std::move(next);
+}
+
+std::vector<std::filesystem::path> FileWatcher::poll() {
+  std::vector<std::filesystem::path> changed{};
+  auto report = [&](const std::filesystem::path &fp) {
+    if (std::ranges::find(changed, fp) == changed.end())
+      changed.push_back(fp);
+  };
+#ifdef __linux__
+  if (fd >= 0) {
+    alignas(inotify_event) char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char *p = buffer; p < buffer + n;) {
+        auto *event = reinterpret_cast<inotify_event *>(p);
+        p += sizeof(inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+          // Events were dropped, so any file may have changed
+          for (auto &w : files)
+            report(w.fp);
+          continue;
+        }
+        if (event->mask & IN_IGNORED) {
+          // The directory is gone; its files fall back to polling
+          for (auto &w : files) {
+            if (w.wd == event->wd)
+              w.wd = -1;
+          }
+          continue;
+        }
+        if (event->len == 0)
+          continue;
+        std::string_view name{event->name};
+        for (auto &w : files) {
+          if (w.wd == event->wd && w.name == name)
+            report(w.fp);
+        }
+      }
+    }
+  }
+#endif
+  // Files without an inotify watch are polled by modification time
+  uint64_t now = Profiler::now_ns();
+  if (now - polled_ns < 1'000'000'000)
+    return changed;
+  polled_ns = now;
+  for (auto &w : files) {
+    if (w.wd >= 0)
+      continue;
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(w.fp, ec);
+    if (!ec && mtime != w.mtime) {
+      w.mtime = mtime;
+      report(w.fp);
+    }
+  }
+  return changed;
+}
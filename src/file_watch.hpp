@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Reports changes other programs make to a set of files. On Linux the
+// directory of each file is watched with inotify, which sees writes in
+// place as well as saves that replace the file. Files without a watch,
+// and all files elsewhere, have their modification times compared once a
+// second.
+class FileWatcher {
+  struct Watched {
+    std::filesystem::path fp{};
+    // inotify watch of the file's directory, -1 if it could not be added
+    int wd{-1};
+    std::string name{};
+    std::filesystem::file_time_type mtime{};
+  };
+  std::vector<Watched> files{};
+  int fd{-1};
+  uint64_t polled_ns{0};
+
+public:
+  FileWatcher();
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+  ~FileWatcher();
+
+  // Watches exactly these files from now on
+  void watch(const std::vector<std::filesystem::path> &fps);
+  // Files changed since the last poll. Never blocks.
+  std::vector<std::filesystem::path> poll();
+};
@@ -0,0 +1,28 @@
+#include "frame_arena.hpp"
+#include <memory>
+
+void *FrameArena::do_allocate(size_t bytes, size_t align) {
+  void *p = buffer.data() + used;
+  size_t space = buffer.size() - used;
+  if (std::align(align, bytes, p, space)) {
+    used = buffer.size() - space + bytes;
+    return p;
+  }
+  spilled += bytes + align;
+  void *heap = std::pmr::new_delete_resource()->allocate(bytes, align);
+  overflow.push_back({heap, {bytes, align}});
+  return heap;
+}
+
+void FrameArena::reset() {
+  for (auto &[p, size] : overflow)
+    std::pmr::new_delete_resource()->deallocate(p, size.first, size.second);
+  overflow.clear();
+  if (spilled > 0) {
+    buffer.resize(2 * (buffer.size() + spilled));
+    spilled = 0;
+  }
+  used = 0;
+}
+
+FrameArena::~FrameArena() { reset(); }
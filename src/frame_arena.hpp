@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Bump allocator for temporaries that live for one frame. reset() drops
+// everything at once; if a frame spilled to the heap, the buffer grows so
+// the next frame fits and steady-state frames never touch the heap.
+class FrameArena : public std::pmr::memory_resource {
+  std::vector<std::byte> buffer{};
+  size_t used{0};
+  size_t spilled{0};
+  std::vector<std::pair<void *, std::pair<size_t, size_t>>> overflow{};
+
+  void *do_allocate(size_t bytes, size_t align) override;
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource &other)
+      const noexcept override {
+    return this == &other;
+  }
+
+public:
+  FrameArena(size_t initial = 64 * 1024) : buffer(initial) {}
+  ~FrameArena();
+  void reset();
+};
@@ -0,0 +1,349 @@
+#include "highlight.hpp"
+#include <algorithm>
+#include <array>
+#include <span>
+
+namespace {
+
+enum CharClass : uint8_t {
+  Class_Other,
+  Class_Space,
+  Class_Ident,
+  Class_Digit,
+  Class_Quote,
+};
+
+constexpr std::array<uint8_t, 256> char_classes = []() {
+  std::array<uint8_t, 256> classes{};
+  for (int c = 0; c < 256; ++c) {
+    if (c == ' ' || c == '\t' || c == '\r')
+      classes[c] = Class_Space;
+    else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+             c >= 0x80)
+      classes[c] = Class_Ident;
+    else if (c >= '0' && c <= '9')
+      classes[c] = Class_Digit;
+    else if (c == '"' || c == '\'' || c == '`')
+      classes[c] = Class_Quote;
+  }
+  return classes;
+}();
+
+// What is left open at the end of a line
+enum LexState : uint8_t {
+  Lex_Normal,
+  Lex_BlockComment,
+  Lex_TripleDouble,
+  Lex_TripleSingle,
+  Lex_SingleQuoted,
+  Lex_DoubleQuoted,
+};
+
+constexpr std::string_view cpp_keywords[]{
+    "alignas",      "alignof",   "auto",          "break",
+    "case",         "catch",     "class",         "co_await",
+    "co_return",    "co_yield",  "const",         "const_cast",
+    "consteval",    "constexpr", "constinit",     "continue",
+    "decltype",     "default",   "delete",        "do",
+    "dynamic_cast", "else",      "enum",          "explicit",
+    "export",       "extern",    "false",         "for",
+    "friend",       "goto",      "if",            "inline",
+    "mutable",      "namespace", "new",           "noexcept",
+    "nullptr",      "operator",  "private",       "protected",
+    "public",       "return",    "reinterpret_cast", "requires",
+    "sizeof",       "static",    "static_assert", "static_cast",
+    "struct",       "switch",    "template",      "this",
+    "throw",        "true",      "try",           "typedef",
+    "typename",     "union",     "using",         "virtual",
+    "volatile",     "while"};
+constexpr std::string_view cpp_types[]{
+    "bool",    "char",     "char16_t", "char32_t", "char8_t", "double",
+    "float",   "int",      "int16_t",  "int32_t",  "int64_t", "int8_t",
+    "long",    "short",    "signed",   "size_t",   "std",     "uint16_t",
+    "uint32_t", "uint64_t", "uint8_t", "unsigned", "void",    "wchar_t"};
+constexpr std::string_view python_keywords[]{
+    "False", "None",     "True",   "and",    "as",     "assert", "async",
+    "await", "break",    "case",   "class",  "continue", "def",  "del",
+    "elif",  "else",     "except", "finally", "for",   "from",   "global",
+    "if",    "import",   "in",     "is",     "lambda", "match",  "nonlocal",
+    "not",   "or",       "pass",   "raise",  "return", "try",    "while",
+    "with",  "yield"};
+constexpr std::string_view python_types[]{
+    "bool", "bytes", "dict",  "float", "int",  "len", "list",
+    "object", "print", "range", "self", "set", "str", "tuple"};
+constexpr std::string_view shell_keywords[]{
+    "break", "case",  "continue", "do",       "done",   "elif",
+    "else",  "esac",  "exit",     "export",   "fi",     "for",
+    "function", "if", "in",       "local",    "readonly", "return",
+    "select", "then", "time",     "until",    "while"};
+constexpr std::string_view shell_types[]{
+    "alias", "cd",    "echo", "eval",  "exec", "printf", "read",
+    "set",   "shift", "source", "test", "trap", "unset"};
+constexpr std::string_view json_keywords[]{"false", "null", "true"};
+
+// How each language is lexed, indexed by CodeLang
+struct LangRules {
+  std::span<const std::string_view> keywords{};
+  std::span<const std::string_view> types{};
+  std::string_view line_comment{};
+  std::string_view quotes{};
+  bool has_block_comments{false};
+  bool has_preprocessor{false};
+  bool has_triple_quotes{false};
+  // Strings may run over several lines
+  bool has_long_strings{false};
+  bool has_variables{false};
+};
+
+constexpr LangRules lang_rules[]{
+    {},
+    {cpp_keywords, cpp_types, "//", "\"'", true, true, false, false, false},
+    {python_keywords, python_types, "#", "\"'", false, false, true, false,
+     false},
+    {shell_keywords, shell_types, "#", "\"'`", false, false, false, true,
+     true},
+    {json_keywords, {}, {}, "\"", false, false, false, false, false},
+};
+
+uint8_t pack(CodeLang lang, LexState lex) {
+  return static_cast<uint8_t>(static_cast<int>(lang) << 4 | lex);
+}
+
+bool contains(std::span<const std::string_view> words, std::string_view w) {
+  return std::find(words.begin(), words.end(), w) != words.end();
+}
+
+bool is_word_char(char c) {
+  uint8_t cls = char_classes[static_cast<unsigned char>(c)];
+  return cls == Class_Ident || cls == Class_Digit;
+}
+
+} // namespace
+
+CodeLang detect_code_lang(std::string_view line) {
+  size_t first = line.find_first_not_of(" \t");
+  line.remove_prefix(std::min(first, line.size()));
+  size_t last = line.find_last_not_of(" \t\r");
+  line = line.substr(0, last == line.npos ? 0 : last + 1);
+  if (line.starts_with("#!"))
+    return line.find("python") != line.npos ? CodeLang::Python
+                                            : CodeLang::Shell;
+  if (line.starts_with("{") || line.starts_with("["))
+    return CodeLang::Json;
+  for (std::string_view start : {"#include", "#define", "#pragma", "#if",
+                                 "//", "/*", "template", "namespace"})
+    if (line.starts_with(start))
+      return CodeLang::Cpp;
+  for (std::string_view start : {"def ", "import ", "from ", "elif ",
+                                 "print(", "@"})
+    if (line.starts_with(start))
+      return CodeLang::Python;
+  for (std::string_view start :
+       {"$ ", "#", "echo ", "cd ", "export ", "sudo ", "git ", "ls", "mkdir ",
+        "cmake ", "make", "apt ", "pip ", "npm ", "for ", "if ["})
+    if (line.starts_with(start))
+      return CodeLang::Shell;
+  if (line.ends_with(":"))
+    return CodeLang::Python;
+  return CodeLang::Cpp;
+}
+
+uint8_t lex_code_line(std::string_view line, uint8_t state,
+                      std::vector<HighlightSpan> &spans) {
+  spans.clear();
+  CodeLang lang = static_cast<CodeLang>(state >> 4);
+  const LangRules &rules = lang_rules[static_cast<size_t>(lang)];
+  size_t pos{0}, n{line.size()};
+
+  auto mark = [&](size_t at, HighlightKind kind) {
+    if (!spans.empty() && spans.back().start == at)
+      spans.back().kind = kind;
+    else if (spans.empty() ? kind != HighlightKind::Plain
+                           : spans.back().kind != kind)
+      spans.push_back({static_cast<uint32_t>(at), kind});
+  };
+  // Scans to just past `closer`, or to the end of the line if it is not
+  // there
+  auto close = [&](std::string_view closer, bool has_escapes) {
+    while (pos < n) {
+      if (has_escapes && line[pos] == '\\') {
+        pos += 2;
+        continue;
+      }
+      if (line.substr(pos).starts_with(closer)) {
+        pos += closer.size();
+        return true;
+      }
+      ++pos;
+    }
+    pos = n;
+    return false;
+  };
+
+  // Finish whatever the previous line left open
+  switch (state & 0xF) {
+  case Lex_BlockComment:
+    mark(0, HighlightKind::Comment);
+    if (!close("*/", false))
+      return state;
+    break;
+  case Lex_TripleDouble:
+  case Lex_TripleSingle:
+    mark(0, HighlightKind::String);
+    if (!close((state & 0xF) == Lex_TripleDouble ? "\"\"\"" : "'''", true))
+      return state;
+    break;
+  case Lex_SingleQuoted:
+    mark(0, HighlightKind::String);
+    if (!close("'", false))
+      return state;
+    break;
+  case Lex_DoubleQuoted:
+    mark(0, HighlightKind::String);
+    if (!close("\"", true))
+      return state;
+    break;
+  }
+
+  bool is_line_start{pos == 0};
+  while (pos < n) {
+    unsigned char c = line[pos];
+    uint8_t cls = char_classes[c];
+    if (cls == Class_Space) {
+      ++pos;
+      continue;
+    }
+    bool at_start = is_line_start;
+    is_line_start = false;
+    std::string_view rest = line.substr(pos);
+
+    if (!rules.line_comment.empty() && rest.starts_with(rules.line_comment)) {
+      mark(pos, HighlightKind::Comment);
+      break;
+    }
+    if (rules.has_preprocessor && at_start && c == '#') {
+      mark(pos, HighlightKind::Preproc);
+      break;
+    }
+    if (rules.has_block_comments && rest.starts_with("/*")) {
+      mark(pos, HighlightKind::Comment);
+      pos += 2;
+      if (!close("*/", false))
+        return pack(lang, Lex_BlockComment);
+      continue;
+    }
+    if (rules.has_triple_quotes &&
+        (rest.starts_with("\"\"\"") || rest.starts_with("'''"))) {
+      mark(pos, HighlightKind::String);
+      std::string_view closer = rest.substr(0, 3);
+      pos += 3;
+      if (!close(closer, true))
+        return pack(lang, c == '"' ? Lex_TripleDouble : Lex_TripleSingle);
+      continue;
+    }
+    if (cls == Class_Quote && rules.quotes.find(c) != rules.quotes.npos) {
+      size_t start = pos;
+      mark(pos, HighlightKind::String);
+      ++pos;
+      // Shell single quotes take backslashes literally
+      bool has_escapes = !(lang == CodeLang::Shell && c == '\'');
+      bool is_closed = close(line.substr(start, 1), has_escapes);
+      if (!is_closed && rules.has_long_strings && c != '`')
+        return pack(lang, c == '\'' ? Lex_SingleQuoted : Lex_DoubleQuoted);
+      if (lang == CodeLang::Json) {
+        size_t next = line.find_first_not_of(" \t", pos);
+        if (next != line.npos && line[next] == ':')
+          mark(start, HighlightKind::Key);
+      }
+      continue;
+    }
+    if (rules.has_variables && c == '$' && pos + 1 < n) {
+      mark(pos, HighlightKind::Variable);
+      ++pos;
+      if (line[pos] == '{') {
+        close("}", false);
+      } else if (is_word_char(line[pos])) {
+        while (pos < n && is_word_char(line[pos]))
+          ++pos;
+      } else {
+        ++pos;
+      }
+      continue;
+    }
+    if (cls == Class_Digit ||
+        (c == '.' && pos + 1 < n &&
+         char_classes[static_cast<unsigned char>(line[pos + 1])] ==
+             Class_Digit)) {
+      mark(pos, HighlightKind::Number);
+      while (pos < n && (is_word_char(line[pos]) || line[pos] == '.'))
+        ++pos;
+      continue;
+    }
+    if (cls == Class_Ident) {
+      size_t start = pos;
+      while (pos < n && is_word_char(line[pos]))
+        ++pos;
+      std::string_view word = line.substr(start, pos - start);
+      mark(start, contains(rules.keywords, word) ? HighlightKind::Keyword
+                  : contains(rules.types, word)  ? HighlightKind::Type
+                                                 : HighlightKind::Plain);
+      continue;
+    }
+    mark(pos, HighlightKind::Plain);
+    ++pos;
+  }
+  return pack(lang, Lex_Normal);
+}
+
+void CodeHighlighter::edit(size_t row, size_t removed, size_t added) {
+  if (row + removed >= lines.size()) {
+    lines.clear();
+    return;
+  }
+  lines[row].is_dirty = true;
+  lines.erase(lines.begin() + row + 1, lines.begin() + row + 1 + removed);
+  lines.insert(lines.begin() + row + 1, added, Line{});
+}
+
+size_t CodeHighlighter::update(const Tokens &tokens, std::string_view text,
+                               const std::vector<uint32_t> &row_tokens) {
+  if (lines.size() != row_tokens.size()) {
+    lines.clear();
+    lines.resize(row_tokens.size());
+  }
+  size_t lexed{0};
+  uint8_t state{0};
+  for (size_t r = 0; r < lines.size(); ++r) {
+    Line &line = lines[r];
+    size_t i = row_tokens[r];
+    bool is_code = i < tokens.size() && tokens.is_text(i) &&
+                   tokens.formats[i] & Format_Code;
+    // Clean lines lexed from the same state would come out the same
+    if (!line.is_dirty && line.is_code == is_code &&
+        line.start_state == state) {
+      state = line.end_state;
+      continue;
+    }
+    line.is_dirty = false;
+    line.is_code = is_code;
+    line.start_state = state;
+    if (is_code) {
+      std::string_view code = tokens.view(text, i);
+      uint8_t start = state;
+      if (static_cast<CodeLang>(start >> 4) == CodeLang::None)
+        start = pack(detect_code_lang(code), Lex_Normal);
+      line.end_state = lex_code_line(code, start, line.spans);
+      ++lexed;
+    } else {
+      line.spans.clear();
+      line.end_state = 0;
+    }
+    state = line.end_state;
+  }
+  return lexed;
+}
+
+const std::vector<HighlightSpan> &CodeHighlighter::spans(size_t row) const {
+  static const std::vector<HighlightSpan> none{};
+  return row < lines.size() ? lines[row].spans : none;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "markup.hpp"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+enum class CodeLang : uint8_t { None, Cpp, Python, Shell, Json };
+
+enum class HighlightKind : uint8_t {
+  Plain,
+  Keyword,
+  Type,
+  String,
+  Number,
+  Comment,
+  Preproc,
+  Variable,
+  Key,
+};
+
+// A highlight kind starting at a byte offset into its code line and
+// running to the next span
+struct HighlightSpan {
+  uint32_t start{0};
+  HighlightKind kind{HighlightKind::Plain};
+};
+
+// Guesses the language of a code block from its first line
+CodeLang detect_code_lang(std::string_view line);
+
+// Lexes one code line starting in `state`, the previous line's end state,
+// and returns the state it ends in. States carry the block's language and
+// any string or comment left open.
+uint8_t lex_code_line(std::string_view line, uint8_t state,
+                      std::vector<HighlightSpan> &spans);
+
+// Highlight spans of every code line, cached with the lexer state each
+// line starts and ends in. An edit marks its lines dirty; update re-lexes
+// them and carries on only while the following lines see a different
+// start state than they were lexed with. Markers on other lines can
+// decide whether a line is code at all, so that is checked every update.
+class CodeHighlighter {
+  struct Line {
+    bool is_dirty{true}, is_code{false};
+    uint8_t start_state{0}, end_state{0};
+    std::vector<HighlightSpan> spans{};
+  };
+  std::vector<Line> lines{};
+
+public:
+  // Keeps the cached lines aligned with the text when `row` is edited and
+  // `removed` rows after it are replaced by `added` new ones
+  void edit(size_t row, size_t removed, size_t added);
+  void reset() { lines.clear(); }
+  // Returns how many lines were lexed
+  size_t update(const Tokens &tokens, std::string_view text,
+                const std::vector<uint32_t> &row_tokens);
+  const std::vector<HighlightSpan> &spans(size_t row) const;
+};
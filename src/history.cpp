@@ -0,0 +1,104 @@
+#include "history.hpp"
+#include <ctime>
+#include <imgui.h>
+
+void HistoryBrowser::show() {
+  is_open = true;
+  listed_fp.clear();
+}
+
+void HistoryBrowser::refresh(const std::filesystem::path &fp) {
+  if (fp != listed_fp) {
+    has_selection = false;
+    revision_text.reset();
+    lines.clear();
+    ++diff_generation;
+    is_diffing = false;
+  }
+  listed_fp = fp;
+  listed_generation = store.generation;
+  revisions = store.list(fp);
+  labels.clear();
+  for (auto &rev : revisions) {
+    std::time_t time = static_cast<std::time_t>(rev.time);
+    char stamp[32]{};
+    if (std::tm *tm = std::localtime(&time))
+      std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", tm);
+    labels.push_back(std::string(stamp) + "  " + std::to_string(rev.size) +
+                     " B");
+  }
+}
+
+void HistoryBrowser::select(size_t i) {
+  selected = i;
+  has_selection = true;
+  is_diffing = true;
+  revision_text.reset();
+  lines.clear();
+  size_t generation = ++diff_generation;
+  // A diff superseded by a later selection still runs to the end, and its
+  // result is dropped by the generation check
+  auto diff = [this, generation, rev = revisions[i],
+               current = tabs.current().snapshot()](std::stop_token) {
+    std::optional<std::string> text = store.read(rev);
+    std::vector<DiffLine> diffed{};
+    if (text)
+      diffed = diff_lines(*text, current.text.str());
+    tasks.post([this, generation, text = std::move(text),
+                diffed = std::move(diffed)]() mutable {
+      if (generation != diff_generation)
+        return;
+      revision_text = std::move(text);
+      lines = std::move(diffed);
+      is_diffing = false;
+    });
+  };
+  tasks.run(TaskPriority::Interactive, std::move(diff));
+}
+
+void HistoryBrowser::render() {
+  if (!is_open)
+    return;
+
+  const std::filesystem::path &fp = tabs.current().get_filepath();
+  if (fp != listed_fp || store.generation != listed_generation)
+    refresh(fp);
+
+  ImGui::SetNextWindowSize({800, 500}, ImGuiCond_Once);
+  ImGui::Begin("History", &is_open);
+  auto [stored, saved] = store.usage();
+  ImGui::TextDisabled("%zu revisions. %.1f MiB on disk for %.1f MiB saved",
+                      revisions.size(), stored / 1048576.0,
+                      saved / 1048576.0);
+
+  ImGui::BeginChild("Revisions", ImVec2(240, 0), true);
+  if (revisions.empty())
+    ImGui::TextDisabled("%s", "No saved revisions");
+  // Newest first
+  for (size_t i = revisions.size(); i-- > 0;) {
+    ImGui::PushID(i);
+    if (ImGui::Selectable(labels[i].c_str(), has_selection && selected == i))
+      select(i);
+    ImGui::PopID();
+  }
+  ImGui::EndChild();
+  ImGui::SameLine();
+
+  ImGui::BeginChild("Diff", ImVec2(0, 0), true);
+  if (is_diffing) {
+    ImGui::TextDisabled("%s", "Comparing...");
+  } else if (has_selection && !revision_text) {
+    ImGui::TextDisabled("%s", "This revision could not be read");
+  } else if (has_selection) {
+    if (ImGui::Button("Restore")) {
+      tabs.current().restore(std::string(*revision_text));
+      select(selected);
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled("%s", "Changes from this revision to the open text");
+    render_diff(lines);
+  }
+  ImGui::EndChild();
+
+  ImGui::End();
+}
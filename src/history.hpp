@@ -0,0 +1,41 @@
+#pragma once
+#include "revisions.hpp"
+#include "tabs.hpp"
+#include "task_pool.hpp"
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Lists the saved revisions of the current tab's file and diffs the
+// selected one against the open text on the task pool
+class HistoryBrowser {
+  RevisionStore &store;
+  Tabs &tabs;
+  std::filesystem::path listed_fp{};
+  size_t listed_generation{0};
+  std::vector<Revision> revisions{};
+  std::vector<std::string> labels{};
+  size_t selected{0};
+  bool has_selection{false};
+
+  size_t diff_generation{0};
+  bool is_diffing{false};
+  std::optional<std::string> revision_text{};
+  std::vector<DiffLine> lines{};
+
+  void refresh(const std::filesystem::path &fp);
+  void select(size_t i);
+
+public:
+  bool is_open{false};
+  HistoryBrowser(RevisionStore &store, Tabs &tabs)
+      : store(store), tabs(tabs) {}
+  void show();
+  void render();
+
+private:
+  // Last, so a running diff finishes before the state it writes to is
+  // destroyed
+  TaskGroup tasks{};
+};
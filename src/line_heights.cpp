@@ -0,0 +1,44 @@
+#include "line_heights.hpp"
+#include <algorithm>
+
+void LineHeights::assign(std::vector<float> &&row_heights) {
+  heights = std::move(row_heights);
+  tree.assign(heights.size() + 1, 0.0);
+  // Each node passes its sum up to its parent, building the tree in O(n)
+  for (size_t i = 1; i < tree.size(); ++i) {
+    tree[i] += heights[i - 1];
+    size_t parent = i + (i & -i);
+    if (parent < tree.size())
+      tree[parent] += tree[i];
+  }
+}
+
+void LineHeights::set(size_t row, float height) {
+  double delta = double(height) - heights[row];
+  heights[row] = height;
+  for (size_t i = row + 1; i < tree.size(); i += i & -i)
+    tree[i] += delta;
+}
+
+double LineHeights::offset(size_t row) const {
+  double sum{0};
+  for (size_t i = row; i > 0; i -= i & -i)
+    sum += tree[i];
+  return sum;
+}
+
+size_t LineHeights::find(double offset) const {
+  size_t step{1};
+  while (step * 2 < tree.size())
+    step *= 2;
+  // Walks down from the largest power of two, keeping the longest prefix
+  // that still ends at or above `offset`
+  size_t row{0};
+  for (; step > 0; step /= 2) {
+    if (row + step < tree.size() && tree[row + step] <= offset) {
+      row += step;
+      offset -= tree[row];
+    }
+  }
+  return heights.empty() ? 0 : std::min(row, heights.size() - 1);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Pixel heights of the document's rows in a Fenwick tree, so the offset
+// of a row and the row at an offset are both O(log n), as is changing
+// one row's height.
+class LineHeights {
+  // 1-based; node i sums the i & -i rows ending at row i - 1
+  std::vector<double> tree{0.0};
+  std::vector<float> heights{};
+
+public:
+  void assign(std::vector<float> &&row_heights);
+  size_t size() const { return heights.size(); }
+  float get(size_t row) const { return heights[row]; }
+  void set(size_t row, float height);
+  // Sum of the heights of the rows before `row`
+  double offset(size_t row) const;
+  double total() const { return offset(heights.size()); }
+  // The row covering `offset`, clamped to the last row
+  size_t find(double offset) const;
+};
@@ -1,23 +1,108 @@
-#include "editor.hpp"
+#include "bundle.hpp"
+#include "export.hpp"
 #include "file_exp.hpp"
+#include "history.hpp"
+#include "profiler.hpp"
+#include "quick_open.hpp"
+#include "replay.hpp"
+#include "revisions.hpp"
+#include "session.hpp"
+#include "tabs.hpp"
+#include "task_pool.hpp"
+#include "utility.hpp"
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_opengl.h>
+#include <algorithm>
 #include <backends/imgui_impl_sdl3.h>
 #include <backends/imgui_impl_sdlrenderer3.h>
 #include <imgui.h>
 #include <iostream>
+#include <memory>
 #include <misc/freetype/imgui_freetype.h>
+#include <utility>
 
-int main(int, char *argv[]) {
-  if (!SDL_Init(0))
+int main(int argc, char *argv[]) {
+  std::filesystem::path record_fp{}, replay_fp{}, replay_doc{};
+  std::optional<ExportFormat> export_format{};
+  std::filesystem::path export_in{}, export_out{};
+  std::filesystem::path pack_dir{}, unpack_bundle_fp{}, bundle_fp{};
+  bool compress{false};
+  for (int i = 1; i < argc; ++i) {
+    std::string arg{argv[i]};
+    if (arg == "--export" && i + 3 < argc &&
+        (export_format = parse_export_format(argv[i + 1]))) {
+      export_in = argv[i + 2];
+      export_out = argv[i + 3];
+      i += 3;
+    } else if (arg == "--pack" && i + 2 < argc) {
+      pack_dir = argv[++i];
+      bundle_fp = argv[++i];
+    } else if (arg == "--unpack" && i + 2 < argc) {
+      unpack_bundle_fp = argv[++i];
+      pack_dir = argv[++i];
+    } else if (arg == "--compress") {
+      compress = true;
+    } else if (arg == "--record" && i + 1 < argc) {
+      record_fp = argv[++i];
+    } else if (arg == "--startup-trace") {
+      StartupTrace::enabled = true;
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replay_fp = argv[++i];
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        replay_doc = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--startup-trace] [--record EVENTS |"
+                   " --replay EVENTS [DOCUMENT] | --export html|md IN OUT |"
+                   " --pack DIR BUNDLE [--compress] | --unpack BUNDLE DIR]\n";
+      return 1;
+    }
+  }
+
+  // Exports run headless and never open a window
+  if (export_format)
+    return export_notes(export_in, export_out, *export_format) ? 1 : 0;
+  if (!bundle_fp.empty())
+    return pack_bundle(pack_dir, bundle_fp, compress) ? 0 : 1;
+  if (!unpack_bundle_fp.empty())
+    return unpack_bundle(unpack_bundle_fp, pack_dir) ? 0 : 1;
+  bool is_replay = !replay_fp.empty();
+
+  // Replays run without a visible window so results do not depend on
+  // the desktop
+  if (is_replay)
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+
+  if (!SDL_Init(is_replay ? SDL_INIT_VIDEO : 0))
     return 1;
+  StartupTrace::mark("SDL initialized");
+
+  // Read before the window opens, so it opens where it was last closed.
+  // Replays always start from a fresh window.
+  SessionStore sessions{std::filesystem::current_path()};
+  std::optional<Session> session{};
+  if (!is_replay)
+    session = sessions.load();
+  bool has_geometry = session && !session->is_maximized &&
+                      session->window_w >= 200 && session->window_h >= 200;
 
   SDL_Window *window;
   SDL_Renderer *renderer;
-  if (!SDL_CreateWindowAndRenderer("Take Notes", 800, 600,
-                                   SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED,
-                                   &window, &renderer))
+  SDL_WindowFlags window_flags =
+      is_replay ? SDL_WINDOW_HIDDEN
+                : SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED;
+  int window_w{800}, window_h{600};
+  if (has_geometry) {
+    window_flags &= ~SDL_WINDOW_MAXIMIZED;
+    window_w = session->window_w;
+    window_h = session->window_h;
+  }
+  if (!SDL_CreateWindowAndRenderer("Take Notes", window_w, window_h,
+                                   window_flags, &window, &renderer))
     return 1;
+  if (has_geometry)
+    SDL_SetWindowPosition(window, session->window_x, session->window_y);
+  StartupTrace::mark("window created");
 
   IMGUI_CHECKVERSION();
   ImGui::CreateContext();
@@ -25,71 +110,206 @@ int main(int, char *argv[]) {
   ImGuiIO &io = ImGui::GetIO();
   io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
   io.IniFilename = nullptr;
-  io.Fonts->AddFontDefault();
+  // Until the note fonts are read the editor draws with the built-in one
+  ImFont *default_font = io.Fonts->AddFontDefault();
+
+  ImGui_ImplSDL3_InitForSDLRenderer(window, renderer);
+  ImGui_ImplSDLRenderer3_Init(renderer);
+  StartupTrace::mark("ImGui initialized");
+
+  float font_size{20.0f};
+  Tabs tabs{window, renderer, default_font, default_font};
+  tabs.font_size = font_size;
+
   // Sharper text
   ImFontConfig cfg;
   cfg.OversampleH = cfg.OversampleV = 1;
   cfg.RasterizerMultiply = 1.0f;
   cfg.FontLoaderFlags = ImGuiFreeTypeLoaderFlags_Monochrome |
                         ImGuiFreeTypeBuilderFlags_MonoHinting;
-  float font_size{20.0f};
+  // The atlas reads from these for as long as it lives
+  cfg.FontDataOwnedByAtlas = false;
+  std::string plain_ttf{}, bold_ttf{};
+  // Glyphs are rasterized on first use at each size drawn, so adding a
+  // font costs no more than having its file in memory. Fonts are added
+  // between frames, never during one.
+  auto add_fonts = [&](std::string &&plain, std::string &&bold) {
+    if (plain.empty() || bold.empty())
+      return;
+    plain_ttf = std::move(plain);
+    bold_ttf = std::move(bold);
+    ImFont *plain_font = io.Fonts->AddFontFromMemoryTTF(
+        plain_ttf.data(), static_cast<int>(plain_ttf.size()), font_size,
+        &cfg);
+    ImFont *bold_font = io.Fonts->AddFontFromMemoryTTF(
+        bold_ttf.data(), static_cast<int>(bold_ttf.size()), font_size, &cfg);
+    tabs.set_fonts(plain_font, bold_font);
+    StartupTrace::mark("fonts loaded");
+  };
   std::filesystem::path app_dir =
       std::filesystem::weakly_canonical(argv[0]).parent_path();
   std::filesystem::path fonts_dir = app_dir / "fonts";
-  ImFont *plain_font = io.Fonts->AddFontFromFileTTF(
-      (fonts_dir / "NotoSansMono-Medium.ttf").string().c_str(), font_size,
-      &cfg);
-  ImFont *bold_font = io.Fonts->AddFontFromFileTTF(
-      (fonts_dir / "NotoSansMono-ExtraBold.ttf").string().c_str(), font_size,
-      &cfg);
+  std::filesystem::path plain_fp = fonts_dir / "NotoSansMono-Medium.ttf";
+  std::filesystem::path bold_fp = fonts_dir / "NotoSansMono-ExtraBold.ttf";
+  // Lists the directory on the task pool once it first renders
+  FileExplorer explorer{std::filesystem::current_path()};
+  NoteIndex index{explorer.get_root()};
+  explorer.index = &index;
+  RevisionStore revisions{std::filesystem::current_path()};
+  tabs.on_save([&](auto fp) {
+    index.refresh();
+    revisions.record(fp);
+  });
+  explorer.on_open([&](auto fp, auto file, auto line) {
+    tabs.open(fp, std::move(file), line);
+  });
+  QuickOpen quick_open{explorer};
+  HistoryBrowser history{revisions, tabs};
+  explorer.has_example = true;
+  explorer.example_file = tabs.example_file = app_dir / "EXAMPLE.txt";
+  if (session)
+    tabs.width = std::clamp(session->editor_width, 0.1f, 0.95f);
 
-  ImGui_ImplSDL3_InitForSDLRenderer(window, renderer);
-  ImGui_ImplSDLRenderer3_Init(renderer);
+  if (is_replay) {
+    // Replays measure the real fonts from the first event
+    add_fonts(read_file_binary(plain_fp), read_file_binary(bold_fp));
+    if (!replay_doc.empty()) {
+      tabs.open(replay_doc, read_file_text(replay_doc));
+    }
+    int status = replay_events(replay_fp, window, tabs, [&]() {
+      TaskPool::get().drain();
+      ImGui_ImplSDLRenderer3_NewFrame();
+      ImGui_ImplSDL3_NewFrame();
+      ImGui::NewFrame();
+      SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+      SDL_RenderClear(renderer);
+      tabs.render();
+      ImGui::Render();
+      ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(), renderer);
+      SDL_RenderPresent(renderer);
+    });
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return status;
+  }
 
-  Editor editor{window, renderer, plain_font, bold_font};
-  editor.font_size = font_size;
-  FileExplorer explorer{std::filesystem::current_path()};
-  std::string switch_contents;
-  std::filesystem::path switch_fp;
-  bool request_switch{false};
-  explorer.on_open([&](auto fp, auto file) {
-    if (!editor.is_save_needed()) {
-      editor.set_text(fp, std::move(file));
-    } else {
-      switch_contents = std::move(file);
-      switch_fp = fp;
-      request_switch = true;
+  std::unique_ptr<EventRecorder> recorder{};
+  if (!record_fp.empty()) {
+    recorder = std::make_unique<EventRecorder>(record_fp, window);
+    if (!recorder->is_open()) {
+      std::cerr << "Cannot write recording " << record_fp << "\n";
+      return 1;
     }
+  }
+
+  // The first frame goes up with the built-in font while the note fonts
+  // are read in the background
+  TaskGroup startup{};
+  startup.run(TaskPriority::Interactive, [&](std::stop_token) {
+    auto plain = std::make_shared<std::string>(read_file_binary(plain_fp));
+    auto bold = std::make_shared<std::string>(read_file_binary(bold_fp));
+    startup.post([&, plain, bold]() {
+      add_fonts(std::move(*plain), std::move(*bold));
+    });
   });
-  explorer.has_example = true;
-  explorer.example_file = editor.example_file = app_dir / "EXAMPLE.txt";
+  // The session's notes are read and parsed in the background too. It is
+  // not saved over until they are back.
+  bool is_session_restored = !session;
+  if (session) {
+    startup.run(TaskPriority::Interactive, [&](std::stop_token) {
+      auto texts = std::make_shared<std::vector<std::optional<std::string>>>();
+      for (auto &tab : session->tabs)
+        texts->push_back(read_note(tab.fp));
+      std::string entry{};
+      std::error_code ec;
+      bool has_root =
+          std::filesystem::is_directory(session->explorer_root, ec) ||
+          find_bundle(session->explorer_root, entry);
+      startup.post([&, texts, has_root]() {
+        if (has_root) {
+          explorer.set_root(session->explorer_root);
+          index.set_root(session->explorer_root);
+        }
+        tabs.restore_session(*session, std::move(*texts));
+        is_session_restored = true;
+        StartupTrace::mark("session restored");
+      });
+    });
+  }
+  auto current_session = [&]() {
+    Session now{};
+    tabs.save_session(now);
+    now.explorer_root = explorer.get_root();
+    SDL_GetWindowPosition(window, &now.window_x, &now.window_y);
+    SDL_GetWindowSize(window, &now.window_w, &now.window_h);
+    now.is_maximized = SDL_GetWindowFlags(window) & SDL_WINDOW_MAXIMIZED;
+    return now;
+  };
+  bool is_first_frame{true}, is_explorer_listed{false};
+  // Anything the session records changed since it was last saved
+  bool is_session_dirty{false};
 
   bool is_resizing{false};
 
+  Profiler &profiler = Profiler::get();
+
   bool is_running{true};
   while (is_running) {
-    auto [ex, ey, ew, eh] = editor.get_bg_rect();
+    bool profiling = Profiler::enabled;
+    if (profiling)
+      profiler.begin_frame();
+
+    auto [ex, ey, ew, eh] = tabs.get_bg_rect();
     int winw, winh;
     SDL_GetWindowSize(window, &winw, &winh);
 
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
       ImGui_ImplSDL3_ProcessEvent(&event);
-      editor.event(event);
+      tabs.event(event);
+      if (recorder && tabs.current().is_focused) {
+        recorder->record(event);
+      }
+      if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_P &&
+          (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL)) {
+        quick_open.show();
+      }
+      if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_H &&
+          (event.key.mod & SDL_KMOD_LCTRL || event.key.mod & SDL_KMOD_RCTRL)) {
+        history.show();
+      }
+      if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F12) {
+        Profiler::enabled = !Profiler::enabled;
+      }
       if (event.type == SDL_EVENT_QUIT) {
         is_running = false;
       }
+      if (event.type == SDL_EVENT_WINDOW_MOVED ||
+          event.type == SDL_EVENT_WINDOW_RESIZED ||
+          event.type == SDL_EVENT_WINDOW_MAXIMIZED ||
+          event.type == SDL_EVENT_WINDOW_RESTORED) {
+        is_session_dirty = true;
+      }
+    }
+
+    // Results of background work land here, between input and drawing
+    {
+      PROFILE_ZONE("TaskPool::drain");
+      TaskPool::get().drain();
     }
 
     auto [cx, cy] = ImGui::GetMousePos();
     if (ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
-      if ((ex + ew - 5 <= cx && cx <= ex + ew + 5 && 0 <= cy && cy <= eh) ||
+      if ((ex + ew - 5 <= cx && cx <= ex + ew + 5 && 0 <= cy &&
+           cy <= ey + eh) ||
           is_resizing) {
         is_resizing = true;
         auto [xrel, _] = ImGui::GetMouseDragDelta();
         ImGui::ResetMouseDragDelta();
-        editor.width += xrel / static_cast<float>(winw);
-        auto [x, y, w, h] = editor.get_bg_rect();
+        tabs.width += xrel / static_cast<float>(winw);
+        is_session_dirty = true;
+        auto [x, y, w, h] = tabs.get_bg_rect();
         ex = x;
         ey = y;
         ew = w;
@@ -101,7 +321,7 @@ int main(int, char *argv[]) {
 
     explorer.x = ex + ew;
     explorer.y = 0;
-    explorer.h = eh;
+    explorer.h = ey + eh;
     explorer.w = winw - ew;
     explorer.flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
                      ImGuiWindowFlags_NoResize;
@@ -112,12 +332,19 @@ int main(int, char *argv[]) {
 
     SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
     SDL_RenderClear(renderer);
-    editor.render();
+    tabs.render();
     ImGui::SetNextWindowPos({explorer.x, explorer.y});
     ImGui::SetNextWindowSize({explorer.w, explorer.h});
     explorer.render();
+    quick_open.render();
+    history.render();
+    if (profiling) {
+      profiler.counter("tokens", tabs.current().token_count());
+      profiler.counter("texture bytes", tabs.current().texture_bytes());
+      profiler.render();
+    }
 
-    if (!is_running && editor.is_save_needed()) {
+    if (!is_running && tabs.is_save_needed()) {
       is_running = true;
       ImGui::OpenPopup("Notice");
     }
@@ -135,30 +362,35 @@ int main(int, char *argv[]) {
       ImGui::EndPopup();
     }
 
-    if (request_switch) {
-      request_switch = false;
-      ImGui::OpenPopup("Notice##Switch");
-    }
-
-    if (ImGui::BeginPopupModal("Notice##Switch", NULL,
-                               ImGuiWindowFlags_AlwaysAutoResize)) {
-      ImGui::TextWrapped("%s",
-                         "You haven't saved your file yet. Switch files?");
-      if (ImGui::Button("Switch", ImVec2(80, 0))) {
-        editor.set_text(switch_fp, std::move(switch_contents));
-        ImGui::CloseCurrentPopup();
-      }
-      if (ImGui::Button("Stay", ImVec2(80, 0))) {
-        ImGui::CloseCurrentPopup();
-      }
-      ImGui::EndPopup();
-    }
-
     ImGui::Render();
     ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(), renderer);
-    SDL_RenderPresent(renderer);
+    {
+      PROFILE_ZONE("SDL_RenderPresent");
+      SDL_RenderPresent(renderer);
+    }
+    if (profiling) {
+      profiler.counter("draw vertices", ImGui::GetDrawData()->TotalVtxCount);
+      profiler.end_frame();
+    }
+    if (is_first_frame) {
+      is_first_frame = false;
+      StartupTrace::mark("first frame presented");
+    }
+    if (!is_explorer_listed && explorer.has_listing()) {
+      is_explorer_listed = true;
+      StartupTrace::mark("explorer listed");
+    }
+    is_session_dirty |= std::exchange(tabs.is_session_dirty, false);
+    is_session_dirty |= std::exchange(explorer.is_session_dirty, false);
+    if (is_session_restored && is_session_dirty && sessions.can_save()) {
+      sessions.save(current_session());
+      is_session_dirty = false;
+    }
   }
 
+  if (is_session_restored)
+    sessions.flush(current_session());
+
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
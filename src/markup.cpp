@@ -1,8 +1,38 @@
 #include "markup.hpp"
 #include "utility.hpp"
 #include <algorithm>
-#include <iostream>
-#include <variant>
+
+void Tokens::clear() {
+  kinds.clear();
+  formats.clear();
+  starts.clear();
+  lens.clear();
+}
+
+void Tokens::truncate(size_t n) {
+  kinds.resize(n);
+  formats.resize(n);
+  starts.resize(n);
+  lens.resize(n);
+}
+
+void Tokens::replace(size_t first, size_t last, const Tokens &with) {
+  auto splice = [&](auto &to, const auto &from) {
+    to.erase(to.begin() + first, to.begin() + last);
+    to.insert(to.begin() + first, from.begin(), from.end());
+  };
+  splice(kinds, with.kinds);
+  splice(formats, with.formats);
+  splice(starts, with.starts);
+  splice(lens, with.lens);
+}
+
+void Tokens::push(TokenKind kind, int format, size_t start, size_t len) {
+  kinds.push_back(kind);
+  formats.push_back(static_cast<uint16_t>(format));
+  starts.push_back(static_cast<uint32_t>(start));
+  lens.push_back(static_cast<uint32_t>(len));
+}
 
 bool Parser::is_eof() { return cursor >= input.size(); }
 bool Parser::bump() {
@@ -11,20 +41,11 @@ bool Parser::bump() {
   cursor += utf8_next_len(input, cursor);
   return true;
 }
-std::string Parser::peek() {
-  if (is_eof())
-    return "";
-
-  size_t next = utf8_next_len(input, cursor);
-  return input.substr(cursor, next);
-}
-bool Parser::match(std::string pat) {
-  if (cursor + pat.size() - 1 >= input.size())
+bool Parser::match(std::string_view pat) {
+  if (cursor + pat.size() > input.size())
+    return false;
+  if (input.substr(cursor, pat.size()) != pat)
     return false;
-  for (size_t i = 0; i < pat.size(); ++i) {
-    if (pat[i] != input[cursor + i])
-      return false;
-  }
   cursor += pat.size();
   return true;
 }
@@ -32,64 +53,76 @@ bool Parser::match(std::string pat) {
 bool Parser::is_special() {
   if (is_eof())
     return true;
-  std::string c = peek();
-  bool spec = c == "*" || c == "\n" || c == "/" || c == "\\" || c == "[";
+  // Lead bytes of multibyte characters never equal an ASCII byte
+  char c = input[cursor];
+  bool spec = c == '*' || c == '\n' || c == '/' || c == '\\' || c == '[';
   if (cursor + 2 < input.size()) {
-    std::string pat2 = input.substr(cursor, 2);
-    spec |= pat2 == "~~";
+    spec |= c == '~' && input[cursor + 1] == '~';
   }
   return spec;
 }
 
-std::vector<Token> Parser::parse_wrapped(std::string which, Format format) {
-  std::vector<Token> total{FormattedString{format, which}};
-  size_t start = cursor;
-  bool is_closed{false};
-  while (!is_eof()) {
-    if (match("\n")) {
-      size_t end = cursor - 1;
-      return {FormattedString{Format_Plain,
-                              which + input.substr(start, end - start)},
-              NewLine{}};
-    }
-    if (match(which)) {
-      is_closed = true;
-      break;
-    }
-    std::vector<Token> toks = parse();
-    for (auto &tok : toks) {
-      if (!std::holds_alternative<FormattedString>(tok)) {
-        total.emplace_back(tok);
-        continue;
-      }
-      FormattedString fmt = std::get<FormattedString>(tok);
-      fmt.format |= format;
-      total.emplace_back(fmt);
-    }
-  }
-  if (is_closed) {
-    total.push_back(FormattedString{format, which});
-  }
-  return total;
+int Parser::active_format() const {
+  return depth ? stack[depth - 1].format : Format_Plain;
 }
 
-std::vector<Token> Parser::parse_bold() {
-  return parse_wrapped("**", Format_Bold);
+void Parser::text(int format, size_t start, size_t len) {
+  tokens.push(TokenKind::Text, format | active_format(), start, len);
 }
 
-std::vector<Token> Parser::parse_strike() {
-  return parse_wrapped("~~", Format_Strike);
+void Parser::newline(size_t pos) {
+  tokens.push(TokenKind::NewLine, Format_Plain, pos, 1);
 }
 
-std::vector<Token> Parser::parse_italic(std::string which) {
-  return parse_wrapped(which, Format_Italic);
+void Parser::open(std::string_view which, Format format, bool is_line_wide,
+                  int head_level) {
+  size_t first = tokens.size();
+  text(format | Format_Marker, cursor - which.size(), which.size());
+  int nested = active_format() | format;
+  stack[depth++] =
+      Frame{which, nested, first, cursor, is_line_wide, head_level};
 }
 
-std::vector<Token> Parser::parse_image() {
+void Parser::close_wrapped() {
+  text(Format_Marker, cursor - stack[depth - 1].which.size(),
+       stack[depth - 1].which.size());
+  --depth;
+}
+
+void Parser::close_line_wide() {
+  const Frame &frame = stack[--depth];
+  if (frame.head_level == 0)
+    return;
+  size_t start = frame.start;
+  while (start < cursor && input[start] == ' ')
+    ++start;
+  outline.push_back(Heading{frame.head_level, start, cursor, row_at(start)});
+}
+
+void Parser::unwind_wrapped() {
+  // A wrapped run cut off by a newline falls back to one plain run from its
+  // opening marker, dropping whatever it had parsed. The newline is left
+  // for parse(), so the next line starts with nothing open and its heading,
+  // code or list marker counts.
+  const Frame &frame = stack[--depth];
+  size_t begin = frame.start - frame.which.size();
+  tokens.truncate(frame.first);
+  text(Format_Plain, begin, cursor - begin);
+}
+
+void Parser::parse_wrapped(std::string_view which, Format format) {
+  if (depth == stack.size()) {
+    text(Format_Plain, cursor - which.size(), which.size());
+    return;
+  }
+  open(which, format, false);
+}
+
+void Parser::parse_image() {
   size_t start{cursor};
   bool is_closed{false};
   while (!is_eof()) {
-    if (peek() == "\n")
+    if (input[cursor] == '\n')
       break;
     if (match("]")) {
       is_closed = true;
@@ -97,150 +130,270 @@ std::vector<Token> Parser::parse_image() {
     }
     bump();
   }
-  if (!is_closed) {
-    return {FormattedString{Format_Plain,
-                            "[" + input.substr(start, cursor - start)}};
-  } else {
-    std::filesystem::path fp{input.substr(start, cursor - start - 1)};
-    return {FormattedString{Format_Plain,
-                            "[" + input.substr(start, cursor - start)},
-            Image{fp}};
-  }
-}
-
-std::vector<Token> Parser::parse_line_wide(std::string which, Format format) {
-  std::vector<Token> total{FormattedString{format, which}};
-  while (!is_eof()) {
-    if (peek() == "\n") {
-      break;
-    }
-    std::vector<Token> toks = parse();
-    for (auto &tok : toks) {
-      if (!std::holds_alternative<FormattedString>(tok)) {
-        total.emplace_back(tok);
-        continue;
-      }
-      FormattedString fmt = std::get<FormattedString>(tok);
-      fmt.format |= format;
-      total.emplace_back(fmt);
-    }
+  text(Format_Plain, start - 1, cursor - start + 1);
+  if (is_closed) {
+    tokens.push(TokenKind::Image, Format_Plain, start, cursor - start - 1);
   }
-  return total;
 }
 
-std::vector<Token> Parser::parse_head(std::string which, Format head_n) {
-  return parse_line_wide(which, head_n);
+size_t Parser::row_at(size_t pos) {
+  // Headings are found in order, so rows are counted once across the parse
+  row += std::count(input.begin() + row_pos, input.begin() + pos, '\n');
+  row_pos = pos;
+  return row;
 }
 
-std::vector<Token> Parser::parse_plain() {
-  FormattedString str{};
+void Parser::parse_plain() {
+  size_t start = cursor;
   while (!is_eof() && !is_special()) {
-    std::string c = peek();
     bump();
-    str.value.append(c);
   }
-  return {str};
+  text(Format_Plain, start, cursor - start);
 }
 
-std::vector<Token> Parser::parse_code() {
+void Parser::parse_code() {
   size_t end = input.find('\n', cursor);
   if (end == input.npos) {
     end = input.size();
   }
-  std::vector<Token> toks{
-      FormattedString{Format_Code, "\t" + input.substr(cursor, end - cursor)}};
+  text(Format_Code, cursor - 1, end - cursor + 1);
   cursor = end;
-  return toks;
 }
 
-std::vector<Token> Parser::parse_list() {
-  return parse_line_wide("•", Format_List);
-}
-
-std::vector<Token> Parser::parse_table() {
-  std::vector<Token> total{FormattedString{Format_Table, "|"}};
-  size_t start{cursor};
-  std::string now{};
+void Parser::parse_table() {
+  size_t first = tokens.size();
+  text(Format_Table | Format_Marker, cursor - 1, 1);
+  size_t start{cursor}, cell{cursor};
   bool is_closed{false};
-  while (!is_eof() && peek() != "\n") {
+  while (!is_eof() && input[cursor] != '\n') {
     if (match("|")) {
       is_closed = true;
-      total.push_back(FormattedString{Format_Table, now});
-      total.push_back(FormattedString{Format_Table, "|"});
-      now.clear();
+      text(Format_Table, cell, cursor - 1 - cell);
+      text(Format_Table | Format_Marker, cursor - 1, 1);
+      cell = cursor;
     } else {
       is_closed = false;
-      now += peek();
       bump();
     }
   }
-  if (!now.empty() || !is_closed) {
+  if (cell != cursor || !is_closed) {
     cursor = start;
-    return {FormattedString{Format_Plain, "|"}};
+    tokens.truncate(first);
+    text(Format_Plain, start - 1, 1);
   }
-  return total;
 }
 
-std::vector<Token> Parser::parse_line_begin() {
+void Parser::parse_line_begin() {
   if (match("###")) {
-    return parse_head("###", Format_Head3);
+    open("###", Format_Head3, true, 3);
   } else if (match("##")) {
-    return parse_head("##", Format_Head2);
+    open("##", Format_Head2, true, 2);
   } else if (match("#")) {
-    return parse_head("#", Format_Head1);
+    open("#", Format_Head1, true, 1);
   } else if (match("\t")) {
-    return parse_code();
+    parse_code();
   } else if (match("•")) {
-    return parse_list();
+    open("•", Format_List, true);
   } else if (match("|")) {
-    return parse_table();
+    parse_table();
+  } else {
+    parse_plain();
   }
-  return parse_plain();
 }
 
-std::vector<Token> Parser::parse() {
+void Parser::parse() {
   if (match("\\")) {
     if (!is_eof() && is_special()) {
-      std::string c = peek();
+      size_t start = cursor - 1;
+      bool is_newline = input[cursor] == '\n';
       bump();
-      if (c == "\n") {
-        return {FormattedString{Format_Plain, "\\"}, NewLine{}};
+      if (is_newline) {
+        text(Format_Plain, start, 1);
+        newline(start + 1);
+        return;
       }
-      return {FormattedString{Format_Plain, "\\" + c}};
+      text(Format_Plain, start, cursor - start);
     } else {
-      return {FormattedString{Format_Plain, "\\"}};
+      text(Format_Plain, cursor - 1, 1);
     }
+    return;
   }
   if (match("**")) {
-    return parse_bold();
-  }
-  if (match("~~")) {
-    return parse_strike();
-  }
-  if (match("/")) {
-    return parse_italic("/");
+    parse_wrapped("**", Format_Bold);
+  } else if (match("~~")) {
+    parse_wrapped("~~", Format_Strike);
+  } else if (match("/")) {
+    parse_wrapped("/", Format_Italic);
+  } else if (match("*")) {
+    parse_wrapped("*", Format_Italic);
+  } else if (match("[")) {
+    parse_image();
+  } else if (match("\n")) {
+    newline(cursor - 1);
+    parse_line_begin();
+  } else if (cursor == 0) {
+    parse_line_begin();
+  } else {
+    parse_plain();
   }
-  if (match("*")) {
-    return parse_italic("*");
+}
+
+void Parser::parse_all() {
+  while (depth || !is_eof()) {
+    if (depth) {
+      const Frame &top = stack[depth - 1];
+      if (top.is_line_wide) {
+        if (is_eof() || input[cursor] == '\n') {
+          close_line_wide();
+          continue;
+        }
+      } else if (is_eof()) {
+        // Unclosed at the end of the input keeps its formatting
+        --depth;
+        continue;
+      } else if (input[cursor] == '\n' ||
+                 input.substr(cursor, 2) == "\\\n") {
+        // An escaped newline cuts a wrapped run off too. Otherwise dropping
+        // the run's tokens would drop that line's NewLine with them.
+        unwind_wrapped();
+        continue;
+      } else if (match(top.which)) {
+        close_wrapped();
+        continue;
+      }
+    }
+    parse();
   }
-  if (match("[")) {
-    return parse_image();
+}
+
+// Whether the newline at `pos` is preceded by a backslash, which may escape
+// it. Backslashes inside code, tables and images do not, but treating them
+// alike only ever takes in more lines than needed.
+static bool is_escaped(std::string_view text, size_t pos) {
+  return pos > 0 && pos < text.size() && text[pos - 1] == '\\';
+}
+
+std::pair<std::string_view, std::string_view>
+edit_lines(std::string_view text, ParsedEdit &edit) {
+  size_t newline = edit.start > 0 ? text.rfind('\n', edit.start - 1)
+                                  : std::string::npos;
+  // The first line must follow a newline that ends the line before it
+  while (newline != std::string::npos && is_escaped(text, newline))
+    newline = newline > 0 ? text.rfind('\n', newline - 1) : std::string::npos;
+  edit.begin = newline == std::string::npos ? 0 : newline + 1;
+  // The line after the last is parsed again if the edit adds or removes
+  // the backslash before the newline between them
+  edit.line_end = std::min(text.find('\n', edit.end), text.size());
+  bool is_new_escaped{false};
+  if (edit.line_end > edit.end)
+    is_new_escaped = is_escaped(text, edit.line_end);
+  else if (!edit.text.empty())
+    is_new_escaped = edit.text.back() == '\\';
+  else
+    is_new_escaped = is_escaped(text, edit.start);
+  while (edit.line_end < text.size() &&
+         (is_new_escaped || is_escaped(text, edit.line_end))) {
+    edit.line_end = std::min(text.find('\n', edit.line_end + 1), text.size());
+    is_new_escaped = is_escaped(text, edit.line_end);
   }
-  if (match("\n")) {
-    std::vector<Token> toks{NewLine{}};
-    auto p = parse_line_begin();
-    toks.insert(toks.end(), p.begin(), p.end());
-    return toks;
+  return {text.substr(edit.begin, edit.start - edit.begin),
+          text.substr(edit.end, edit.line_end - edit.end)};
+}
+
+void parse_edit(ParsedEdit &edit, std::string_view head,
+                std::string_view tail, bool is_last_line) {
+  // The lines are parsed between the newlines around them, whose tokens
+  // are left out: runs still open at a newline end differently than at
+  // the end of the text, and the text's first line begins differently
+  // than the others
+  bool is_first_line = edit.begin == 0;
+  std::string region{};
+  region.reserve(head.size() + edit.text.size() + tail.size() + 2);
+  if (!is_first_line)
+    region += '\n';
+  region.append(head).append(edit.text).append(tail);
+  if (!is_last_line)
+    region += '\n';
+  Parser parser{region, edit.tokens};
+  parser.parse_all();
+  edit.headings = std::move(parser.outline);
+  Tokens &tokens = edit.tokens;
+  if (!is_last_line) {
+    size_t newline = tokens.size();
+    while (newline > 0 && !(tokens.is_newline(newline - 1) &&
+                            tokens.starts[newline - 1] == region.size() - 1))
+      --newline;
+    // Ill-formed UTF-8 can make the parser step over a newline
+    if (newline == 0) {
+      edit.is_local = false;
+      return;
+    }
+    tokens.truncate(newline - 1);
   }
-  if (cursor == 0) {
-    return parse_line_begin();
+  if (!is_first_line) {
+    if (tokens.empty() || !tokens.is_newline(0)) {
+      edit.is_local = false;
+      return;
+    }
+    tokens.replace(0, 1, Tokens{});
+    for (uint32_t &start : tokens.starts)
+      --start;
+    for (Heading &heading : edit.headings) {
+      --heading.start;
+      --heading.end;
+      --heading.row;
+    }
   }
-  return parse_plain();
 }
 
-void Parser::parse_all() {
-  while (!is_eof()) {
-    auto p = parse();
-    tokens.insert(tokens.end(), p.begin(), p.end());
+void splice_edit(std::string_view text, ParsedEdit &edit, Tokens &tokens,
+                 std::vector<Heading> &outline) {
+  auto newlines = [](std::string_view s) {
+    return static_cast<size_t>(std::ranges::count(s, '\n'));
+  };
+  size_t old_rows =
+      newlines(text.substr(edit.begin, edit.line_end - edit.begin));
+  size_t new_rows = old_rows -
+                    newlines(text.substr(edit.start, edit.end - edit.start)) +
+                    newlines(edit.text);
+  size_t line_end = edit.line_end - (edit.end - edit.start) + edit.text.size();
+  // Tokens from the start of the first line up to the newline ending the
+  // last; a blank line's empty token sits on that newline's offset
+  auto &starts = tokens.starts;
+  auto token_at = [&](size_t pos) {
+    return std::ranges::lower_bound(starts, pos) - starts.begin();
+  };
+  size_t first = token_at(edit.begin);
+  size_t last = token_at(edit.line_end);
+  while (last < tokens.size() && starts[last] == edit.line_end &&
+         !tokens.is_newline(last))
+    ++last;
+  auto heading_at = [&](size_t pos) {
+    return std::ranges::lower_bound(outline, pos, {}, &Heading::start) -
+           outline.begin();
+  };
+  size_t first_heading = heading_at(edit.begin);
+  size_t last_heading = heading_at(edit.line_end + 1);
+  size_t row = newlines(text.substr(0, edit.begin));
+
+  // Everything after the lines moves by the change in length and rows
+  for (size_t i = last; i < tokens.size(); ++i)
+    starts[i] = static_cast<uint32_t>(starts[i] + line_end - edit.line_end);
+  for (uint32_t &start : edit.tokens.starts)
+    start += static_cast<uint32_t>(edit.begin);
+  tokens.replace(first, last, edit.tokens);
+  for (size_t h = last_heading; h < outline.size(); ++h) {
+    outline[h].start += line_end - edit.line_end;
+    outline[h].end += line_end - edit.line_end;
+    outline[h].row += new_rows - old_rows;
   }
-}
\ No newline at end of file
+  for (Heading &heading : edit.headings) {
+    heading.start += edit.begin;
+    heading.end += edit.begin;
+    heading.row += row;
+  }
+  outline.erase(outline.begin() + first_heading,
+                outline.begin() + last_heading);
+  outline.insert(outline.begin() + first_heading, edit.headings.begin(),
+                 edit.headings.end());
+}
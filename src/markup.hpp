@@ -1,7 +1,9 @@
 #pragma once
-#include <filesystem>
+#include <array>
+#include <cstdint>
 #include <string>
-#include <variant>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 enum Format : int {
@@ -15,50 +17,138 @@ enum Format : int {
   Format_Strike = 0x40,
   Format_List = 0x80,
   Format_Table = 0x100,
+  // Markup characters themselves: openers, closers and table pipes
+  Format_Marker = 0x200,
 };
 
-struct FormattedString {
-  int format{0};
-  std::string value{};
+enum class TokenKind : uint8_t { NewLine, Text, Image };
+
+// Parser output as parallel arrays. Every token is a byte span of the
+// parsed text: the characters of a Text run, the "\n" of a NewLine, or the
+// path between the brackets of an Image. No Text run spans a newline. A
+// Text run is empty only where a line opens with markup or is blank, or for
+// an empty table cell. clear() keeps the capacity, so a buffer reused
+// across reparses stops allocating once it has grown.
+struct Tokens {
+  std::vector<TokenKind> kinds{};
+  std::vector<uint16_t> formats{};
+  std::vector<uint32_t> starts{};
+  std::vector<uint32_t> lens{};
+
+  size_t size() const { return kinds.size(); }
+  bool empty() const { return kinds.empty(); }
+  void clear();
+  void truncate(size_t n);
+  // Replaces tokens [first, last) with all of `with`
+  void replace(size_t first, size_t last, const Tokens &with);
+  void push(TokenKind kind, int format, size_t start, size_t len);
+  bool is_text(size_t i) const { return kinds[i] == TokenKind::Text; }
+  bool is_newline(size_t i) const { return kinds[i] == TokenKind::NewLine; }
+  bool is_image(size_t i) const { return kinds[i] == TokenKind::Image; }
+  // Bytes of the text the token stands for; images take up none
+  size_t advance(size_t i) const { return is_image(i) ? 0 : lens[i]; }
+  std::string_view view(std::string_view text, size_t i) const {
+    return text.substr(starts[i], lens[i]);
+  }
 };
 
-struct Image {
-  std::filesystem::path fp{};
+struct Heading {
+  int level{1};
+  // Byte span of the title, without the leading #s
+  size_t start{0}, end{0};
+  size_t row{0};
 };
 
-struct NewLine {};
+// Single pass over the input with an explicit stack of open delimiters, so
+// time is linear and memory beyond the tokens is fixed however deeply the
+// markers nest.
+class Parser {
+public:
+  // Wrapped markers nested deeper than this are kept as plain text
+  static constexpr size_t max_depth{64};
 
-using Token = std::variant<NewLine, FormattedString, Image>;
+private:
+  // An open marker: wrapped runs (**, ~~, /, *) wait for their closer,
+  // line-wide runs (headings, lists) for the end of the line
+  struct Frame {
+    std::string_view which{};
+    // Includes the formats of the enclosing frames
+    int format{0};
+    // Token index of the opening marker
+    size_t first{0};
+    // First byte after the opening marker
+    size_t start{0};
+    bool is_line_wide{false};
+    int head_level{0};
+  };
 
-class Parser {
-  std::string input;
+  std::string_view input;
   size_t cursor{0};
+  size_t row{0}, row_pos{0};
+  // Line-wide frames only open at the start of a line, below any wrapped
+  std::array<Frame, max_depth + 1> stack{};
+  size_t depth{0};
+
+  size_t row_at(size_t pos);
 
   bool is_eof();
   bool bump();
-  std::string peek();
-  bool match(std::string pat);
+  bool match(std::string_view pat);
   bool is_special();
 
-  std::vector<Token> parse_wrapped(std::string which, Format fmt);
-  std::vector<Token> parse_line_wide(std::string which, Format fmt);
+  int active_format() const;
+  void text(int format, size_t start, size_t len);
+  void newline(size_t pos);
+  void open(std::string_view which, Format format, bool is_line_wide,
+            int head_level = 0);
+  void close_wrapped();
+  void close_line_wide();
+  void unwind_wrapped();
+
+  void parse_wrapped(std::string_view which, Format format);
+  void parse_image();
+  void parse_table();
+  void parse_line_begin();
+  void parse_code();
+  void parse_plain();
+  void parse();
 
 public:
-  std::vector<Token> tokens;
-
-  Parser(std::string input) : input(input) {}
-  Parser(std::string &&input) : input(std::move(input)) {}
-
-  std::vector<Token> parse_bold();
-  std::vector<Token> parse_italic(std::string which);
-  std::vector<Token> parse_strike();
-  std::vector<Token> parse_head(std::string which, Format head_n);
-  std::vector<Token> parse_list();
-  std::vector<Token> parse_image();
-  std::vector<Token> parse_table();
-  std::vector<Token> parse_line_begin();
-  std::vector<Token> parse_code();
-  std::vector<Token> parse_plain();
-  std::vector<Token> parse();
+  Tokens &tokens;
+  std::vector<Heading> outline;
+
+  // `input` must outlive the parser and `tokens` is cleared first
+  Parser(std::string_view input, Tokens &tokens)
+      : input(input), tokens(tokens) {
+    tokens.clear();
+  }
+
   void parse_all();
-};
\ No newline at end of file
+};
+
+// Text replacing [start, end), with the lines it lands in parsed again.
+// The tokens and headings are relative to `begin`, where the first of
+// those lines starts, and stand in for the ones up to `line_end`. If the
+// lines could not be parsed on their own, the whole text is parsed again
+// instead.
+struct ParsedEdit {
+  size_t start{0}, end{0}, begin{0}, line_end{0};
+  std::string text{};
+  Tokens tokens{};
+  std::vector<Heading> headings{};
+  bool is_local{true};
+};
+
+// Sets the lines an edit of `text` lands in and returns the text before
+// and after the edit on them. Lines joined by an escaped newline count as
+// one.
+std::pair<std::string_view, std::string_view>
+edit_lines(std::string_view text, ParsedEdit &edit);
+// Parses the lines set by edit_lines on their own; `is_last_line` if they
+// run to the end of the text
+void parse_edit(ParsedEdit &edit, std::string_view head,
+                std::string_view tail, bool is_last_line);
+// Replaces the tokens and headings of the lines a local edit lands in.
+// `text` is the text before the edit.
+void splice_edit(std::string_view text, ParsedEdit &edit, Tokens &tokens,
+                 std::vector<Heading> &outline);
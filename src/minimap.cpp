@@ -0,0 +1,213 @@
+#include "minimap.hpp"
+#include <algorithm>
+
+Minimap::~Minimap() {
+  if (texture)
+    SDL_DestroyTexture(texture);
+}
+
+int Minimap::rows() const {
+  return static_cast<int>(std::min<size_t>(lines.size() * 2, height));
+}
+
+// Short documents get two pixel rows per line, the second left blank;
+// longer ones are squeezed into the texture
+float Minimap::line_to_row(double line) const {
+  if (lines.size() * 2 <= height)
+    return static_cast<float>(line * 2);
+  return static_cast<float>(line * height / lines.size());
+}
+
+double Minimap::row_to_line(float row) const {
+  if (lines.size() * 2 <= height)
+    return row / 2.0;
+  return double(row) * lines.size() / height;
+}
+
+static int line_format_rank(int format) {
+  if (format & (Format_Head1 | Format_Head2 | Format_Head3))
+    return 5;
+  if (format & Format_Code)
+    return 4;
+  if (format & Format_Table)
+    return 3;
+  if (format & Format_List)
+    return 2;
+  return 1;
+}
+
+void Minimap::edit(size_t row, size_t removed, size_t added) {
+  if (row + removed >= lines.size()) {
+    lines.clear();
+    return;
+  }
+  int old_rows = rows();
+  bool was_squeezed = lines.size() * 2 > height;
+  lines.erase(lines.begin() + row + 1, lines.begin() + row + 1 + removed);
+  lines.insert(lines.begin() + row + 1, added, LineSummary{});
+  if (removed != added) {
+    // Lines below the edit move, and a squeezed layout moves everywhere
+    bool is_squeezed = was_squeezed || lines.size() * 2 > height;
+    mark_dirty(is_squeezed ? 0 : static_cast<int>(line_to_row(row)),
+               std::max(old_rows, rows()));
+  }
+  // The edited lines are summarized again, and so is the line after them,
+  // which a backslash added or removed at their end joins or splits off.
+  // Stale lines further down move with the edit.
+  size_t begin = row, end = row + added + 2;
+  if (stale_begin < stale_end) {
+    begin = std::min(begin, stale_begin);
+    if (stale_end > row + 1)
+      end = std::max(end, std::max(stale_end - std::min(stale_end, removed),
+                                   row + 1) +
+                              added);
+  }
+  stale_begin = begin;
+  stale_end = end;
+}
+
+void Minimap::update(const Tokens &tokens, std::string_view text,
+                     const std::vector<uint32_t> &row_tokens) {
+  size_t n = row_tokens.size();
+  if (lines.size() != n) {
+    int old_rows = rows();
+    lines.assign(n, LineSummary{});
+    stale_begin = 0;
+    stale_end = n;
+    mark_dirty(0, std::max(old_rows, rows()));
+  }
+  // A line after an escaped newline continues the one before, so a
+  // change there can carry on to it
+  auto is_continued = [&](size_t r) {
+    size_t newline = row_tokens[r] - 1;
+    size_t pos = tokens.starts[newline];
+    return pos > 0 && text[pos - 1] == '\\';
+  };
+  for (size_t r = stale_begin;
+       r < n && (r < stale_end || (r > 0 && is_continued(r))); ++r) {
+    size_t end = r + 1 < n ? row_tokens[r + 1] : tokens.size();
+    LineSummary line{};
+    size_t indent{0}, length{0};
+    bool is_image{false};
+    for (size_t i = row_tokens[r]; i < end; ++i) {
+      if (tokens.is_image(i)) {
+        is_image = true;
+        continue;
+      }
+      if (!tokens.is_text(i))
+        continue;
+      std::string_view value = tokens.view(text, i);
+      if (length == 0) {
+        size_t first = value.find_first_not_of(" \t");
+        indent += std::min(first, value.size());
+        if (first == value.npos)
+          continue;
+        value.remove_prefix(first);
+      }
+      length += value.size();
+      line.kind = std::max(
+          line.kind,
+          static_cast<LineKind>(line_format_rank(tokens.formats[i])));
+    }
+    if (is_image)
+      line.kind = LineKind::Image;
+    line.indent = static_cast<uint8_t>(std::min<size_t>(indent, 0xFF));
+    line.length = static_cast<uint16_t>(std::min<size_t>(length, 0xFFFF));
+    if (line == lines[r])
+      continue;
+    lines[r] = line;
+    mark_dirty(static_cast<int>(line_to_row(r)),
+               static_cast<int>(line_to_row(r + 1)) + 1);
+  }
+  stale_begin = stale_end = 0;
+}
+
+void Minimap::mark_dirty(int begin, int end) {
+  begin = std::max(begin, 0);
+  end = std::min(end, height);
+  if (begin >= end)
+    return;
+  if (dirty_begin < dirty_end) {
+    begin = std::min(begin, dirty_begin);
+    end = std::max(end, dirty_end);
+  }
+  dirty_begin = begin;
+  dirty_end = end;
+}
+
+void Minimap::rasterize(int begin, int end) {
+  static constexpr uint32_t colors[]{
+      0,
+      IM_COL32(0xA0, 0xA0, 0xA0, 0xA0), // Plain
+      IM_COL32(0xC8, 0xC8, 0xC8, 0xB0), // List
+      IM_COL32(0x60, 0xA0, 0xF0, 0xD0), // Table
+      IM_COL32(0x70, 0xD0, 0x80, 0xD0), // Code
+      IM_COL32(0xFF, 0xFF, 0xFF, 0xFF), // Heading
+      IM_COL32(0xF0, 0xA0, 0x40, 0xFF), // Image
+  };
+  band.assign(static_cast<size_t>(end - begin) * width, 0);
+  size_t n = lines.size();
+  bool is_squeezed = n * 2 > height;
+  for (int row = begin; row < end; ++row) {
+    size_t first, last;
+    if (is_squeezed) {
+      first = size_t(row) * n / height;
+      last = std::max(first + 1, size_t(row + 1) * n / height);
+    } else {
+      if (row % 2 != 0)
+        continue;
+      first = size_t(row) / 2;
+      last = first + 1;
+    }
+    LineKind kind{LineKind::Blank};
+    size_t left{SIZE_MAX}, right{0};
+    for (size_t l = first; l < std::min(last, n); ++l) {
+      const LineSummary &line = lines[l];
+      if (line.kind == LineKind::Blank)
+        continue;
+      kind = std::max(kind, line.kind);
+      left = std::min<size_t>(left, line.indent);
+      right = std::max<size_t>(right, line.indent + line.length);
+    }
+    if (kind == LineKind::Blank)
+      continue;
+    // Two columns per pixel
+    uint32_t *px = band.data() + size_t(row - begin) * width;
+    uint32_t color = colors[static_cast<size_t>(kind)];
+    for (size_t x = left / 2; x < std::min<size_t>(width, (right + 1) / 2);
+         ++x)
+      px[x] = color;
+  }
+}
+
+void Minimap::draw(SDL_Renderer *renderer, ImDrawList *draw_list,
+                   ImVec2 min, ImVec2 max) {
+  if (!texture) {
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888,
+                                SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!texture)
+      return;
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    // A new texture starts undefined
+    dirty_begin = 0;
+    dirty_end = height;
+  }
+  if (dirty_begin < dirty_end) {
+    rasterize(dirty_begin, dirty_end);
+    SDL_Rect rect{0, dirty_begin, width, dirty_end - dirty_begin};
+    SDL_UpdateTexture(texture, &rect, band.data(),
+                      width * sizeof(uint32_t));
+    dirty_begin = dirty_end = 0;
+  }
+  draw_list->AddImage(ImTextureRef(reinterpret_cast<ImTextureID>(texture)),
+                      min, max, {0.0f, 0.0f},
+                      {1.0f, static_cast<float>(rows()) / height});
+}
+
+void Minimap::trim() {
+  if (texture)
+    SDL_DestroyTexture(texture);
+  texture = nullptr;
+  band.clear();
+  band.shrink_to_fit();
+}
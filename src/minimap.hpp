@@ -0,0 +1,73 @@
+#pragma once
+#include "markup.hpp"
+#include <SDL3/SDL.h>
+#include <cstdint>
+#include <imgui.h>
+#include <string_view>
+#include <vector>
+
+// Overview of the document drawn beside the editor. Each row is reduced
+// to a summary of its kind, indent and length, and the summaries are
+// rasterized into a texture. Edits mark the summaries of their lines
+// stale, so an update only summarizes those again. Only pixel rows of
+// lines whose summary changed are redrawn and uploaded, so an unchanged
+// document costs one image per frame.
+class Minimap {
+public:
+  static constexpr int width = 64;
+  // Texture rows. Documents over half this many lines share pixel rows.
+  static constexpr int height = 2048;
+
+private:
+  // Ordered by precedence when lines share a pixel row
+  enum class LineKind : uint8_t {
+    Blank,
+    Plain,
+    List,
+    Table,
+    Code,
+    Heading,
+    Image
+  };
+  struct LineSummary {
+    LineKind kind{LineKind::Blank};
+    uint8_t indent{0};
+    uint16_t length{0};
+    bool operator==(const LineSummary &) const = default;
+  };
+
+  std::vector<LineSummary> lines{};
+  // Lines to summarize again at the next update
+  size_t stale_begin{0}, stale_end{0};
+  std::vector<uint32_t> band{};
+  SDL_Texture *texture{nullptr};
+  // Pixel rows waiting to be redrawn
+  int dirty_begin{0}, dirty_end{0};
+
+  void mark_dirty(int begin, int end);
+  void rasterize(int begin, int end);
+
+public:
+  Minimap() = default;
+  Minimap(const Minimap &) = delete;
+  Minimap &operator=(const Minimap &) = delete;
+  ~Minimap();
+
+  // Pixel rows covering the document
+  int rows() const;
+  // Pixel row of a line, fractions included, and the reverse
+  float line_to_row(double line) const;
+  double row_to_line(float row) const;
+  // Keeps the summaries aligned with the text when `row` is edited and
+  // `removed` lines after it are replaced by `added` new ones
+  void edit(size_t row, size_t removed, size_t added);
+  // Summarizes every line again at the next update
+  void reset() { lines.clear(); }
+  void update(const Tokens &tokens, std::string_view text,
+              const std::vector<uint32_t> &row_tokens);
+  // Uploads what changed and draws rows() pixel rows into the rectangle
+  void draw(SDL_Renderer *renderer, ImDrawList *draw_list, ImVec2 min,
+            ImVec2 max);
+  // Frees the texture; the next draw rebuilds it
+  void trim();
+};
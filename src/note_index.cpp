@@ -0,0 +1,493 @@
+#include "note_index.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <utility>
+
+static const char index_magic[4] = {'T', 'N', 'I', 'X'};
+static const uint32_t index_version = 1;
+static const uint64_t max_file_size = 64ull << 20;
+
+static bool is_word_byte(unsigned char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80;
+}
+
+// Splits on ASCII punctuation and whitespace, lowercasing ASCII letters.
+// Multibyte UTF-8 sequences are kept inside words.
+template <typename Fn> static void tokenize(std::string_view text, Fn &&fn) {
+  uint32_t line{0};
+  std::string term{};
+  for (size_t i = 0; i <= text.size(); ++i) {
+    unsigned char c = i < text.size() ? text[i] : '\n';
+    if (is_word_byte(c)) {
+      if (term.size() < 64)
+        term += (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+      continue;
+    }
+    if (term.size() >= 2)
+      fn(term, line);
+    term.clear();
+    if (c == '\n')
+      ++line;
+  }
+}
+
+NoteIndex::NoteIndex(std::filesystem::path root)
+    : root(root), store_path(root / ".take-notes-index") {
+  worker = std::jthread([this](std::stop_token stop) { run(stop); });
+}
+
+void NoteIndex::refresh() {
+  {
+    std::lock_guard lock{wake_mtx};
+    wake = true;
+  }
+  wake_cv.notify_one();
+}
+
+void NoteIndex::set_root(const std::filesystem::path &root) {
+  {
+    std::lock_guard lock{wake_mtx};
+    next_root = root;
+    wake = true;
+  }
+  wake_cv.notify_one();
+}
+
+std::filesystem::path NoteIndex::get_root() {
+  std::shared_lock lock{mtx};
+  return root;
+}
+
+void NoteIndex::run(std::stop_token stop) {
+  load();
+  while (!stop.stop_requested()) {
+    std::optional<std::filesystem::path> to{};
+    {
+      std::unique_lock lock{wake_mtx};
+      // Files written by other programs are picked up by the periodic rescan
+      wake_cv.wait_for(lock, stop, std::chrono::seconds(30),
+                       [&] { return wake; });
+      wake = false;
+      to = std::exchange(next_root, std::nullopt);
+    }
+    if (stop.stop_requested())
+      break;
+    if (to)
+      reroot(std::move(*to));
+    scan(stop);
+  }
+}
+
+void NoteIndex::reroot(std::filesystem::path to) {
+  // A bundle is indexed along with the directory it is in
+  std::error_code ec;
+  if (!std::filesystem::is_directory(to, ec))
+    to = to.parent_path();
+  if (to == root)
+    return;
+  {
+    std::unique_lock lock{mtx};
+    root = std::move(to);
+    store_path = root / ".take-notes-index";
+    files.clear();
+    file_ids.clear();
+    term_ids.clear();
+    terms.clear();
+    postings.clear();
+    live_files = 0;
+    ++generation;
+  }
+  load();
+}
+
+uint32_t NoteIndex::get_file_id(const std::filesystem::path &fp) {
+  auto it = file_ids.find(fp);
+  if (it != file_ids.end())
+    return it->second;
+  uint32_t id = files.size();
+  files.push_back(IndexedFile{fp});
+  file_ids.emplace(fp, id);
+  return id;
+}
+
+void NoteIndex::remove_file(uint32_t id) {
+  IndexedFile &file = files[id];
+  if (file.live)
+    --live_files;
+  file.live = false;
+  auto it = file_ids.find(file.fp);
+  if (it != file_ids.end() && it->second == id)
+    file_ids.erase(it);
+}
+
+// Retires a file's entry and returns a new one for the same file, so
+// indexing it again only appends postings
+uint32_t NoteIndex::renew_file(uint32_t id) {
+  if (!files[id].live)
+    return id;
+  IndexedFile renewed = files[id];
+  remove_file(id);
+  renewed.live = false;
+  uint32_t fresh = files.size();
+  files.push_back(std::move(renewed));
+  file_ids.emplace(files[fresh].fp, fresh);
+  return fresh;
+}
+
+// Drops the postings of entries that are not live and renumbers the rest
+void NoteIndex::compact() {
+  std::vector<uint32_t> remap(files.size(), UINT32_MAX);
+  std::vector<IndexedFile> kept{};
+  for (uint32_t id = 0; id < files.size(); ++id) {
+    if (!files[id].live)
+      continue;
+    remap[id] = kept.size();
+    kept.push_back(std::move(files[id]));
+  }
+  for (auto &list : postings) {
+    std::erase_if(
+        list, [&](const Posting &p) { return remap[p.file] == UINT32_MAX; });
+    for (Posting &p : list)
+      p.file = remap[p.file];
+  }
+  files = std::move(kept);
+  file_ids.clear();
+  for (uint32_t id = 0; id < files.size(); ++id)
+    file_ids.emplace(files[id].fp, id);
+}
+
+void NoteIndex::add_file(
+    uint32_t id, const std::vector<std::pair<std::string, uint32_t>> &toks) {
+  IndexedFile &file = files[id];
+  for (auto &[term, line] : toks) {
+    auto [it, inserted] = term_ids.try_emplace(term, terms.size());
+    if (inserted) {
+      terms.push_back(term);
+      postings.emplace_back();
+    }
+    std::vector<Posting> &list = postings[it->second];
+    if (!list.empty() && list.back().file == id && list.back().line == line)
+      continue;
+    list.push_back({id, line});
+  }
+  if (!file.live)
+    ++live_files;
+  file.live = true;
+}
+
+void NoteIndex::scan(std::stop_token stop) {
+  struct Entry {
+    std::filesystem::path fp;
+    int64_t mtime;
+    uint64_t size;
+  };
+  std::vector<Entry> found{};
+  std::error_code ec;
+  auto it = std::filesystem::recursive_directory_iterator(
+      root, std::filesystem::directory_options::skip_permission_denied, ec);
+  for (auto end = std::filesystem::recursive_directory_iterator();
+       !ec && it != end; it.increment(ec)) {
+    if (stop.stop_requested())
+      return;
+    // A file that vanishes mid-walk is skipped without ending the walk
+    std::error_code entry_ec;
+    std::string name = it->path().filename().string();
+    if (!name.empty() && name[0] == '.') {
+      if (it->is_directory(entry_ec))
+        it.disable_recursion_pending();
+      continue;
+    }
+    if (!it->is_regular_file(entry_ec))
+      continue;
+    uint64_t size = it->file_size(entry_ec);
+    if (entry_ec || size > max_file_size)
+      continue;
+    auto mtime = it->last_write_time(entry_ec);
+    if (entry_ec)
+      continue;
+    found.push_back({it->path(), mtime.time_since_epoch().count(), size});
+  }
+  // Files the walk did not reach are kept rather than taken for removed
+  bool is_walked = !ec;
+
+  // The new mtime and size are only recorded once a file is indexed, so
+  // files a stopped scan did not get to are still stale when stored
+  std::vector<std::pair<uint32_t, const Entry *>> changed{};
+  {
+    std::unique_lock lock{mtx};
+    std::vector<bool> seen(files.size(), false);
+    for (auto &entry : found) {
+      uint32_t id = get_file_id(entry.fp);
+      seen.resize(files.size(), false);
+      seen[id] = true;
+      IndexedFile &file = files[id];
+      if (!file.live || file.mtime != entry.mtime || file.size != entry.size)
+        changed.emplace_back(id, &entry);
+    }
+    bool removed{false};
+    for (uint32_t id = 0; is_walked && id < seen.size(); ++id) {
+      if (!seen[id] && files[id].live) {
+        remove_file(id);
+        removed = true;
+      }
+    }
+    if (removed)
+      ++generation;
+  }
+
+  if (changed.empty())
+    return;
+
+  is_indexing = true;
+  progress = 0;
+  total = changed.size();
+
+  std::atomic<size_t> next{0};
+  auto index_worker = [&]() {
+    std::vector<std::pair<std::string, uint32_t>> toks{};
+    for (size_t i = next++; i < changed.size() && !stop.stop_requested();
+         i = next++) {
+      auto [id, entry] = changed[i];
+      std::error_code ec;
+      std::string text{read_file_text(entry->fp, ec)};
+      if (ec) {
+        // Gone since the walk, like an editor's temporary file
+        std::unique_lock lock{mtx};
+        remove_file(id);
+        ++progress;
+        ++generation;
+        continue;
+      }
+      toks.clear();
+      // Binary files are kept as live entries without terms so they are
+      // not re-read on every scan
+      if (text.find('\0') == text.npos) {
+        tokenize(text, [&](const std::string &term, uint32_t line) {
+          toks.emplace_back(term, line);
+        });
+      }
+      std::unique_lock lock{mtx};
+      uint32_t fresh = renew_file(id);
+      add_file(fresh, toks);
+      files[fresh].mtime = entry->mtime;
+      files[fresh].size = entry->size;
+      ++progress;
+      ++generation;
+    }
+  };
+
+  size_t n = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::jthread> pool{};
+  for (size_t i = 0; i + 1 < n; ++i)
+    pool.emplace_back(index_worker);
+  index_worker();
+  pool.clear();
+
+  {
+    // Once most postings are stale, dropping them costs no more than the
+    // indexing that made them stale
+    std::unique_lock lock{mtx};
+    if (files.size() - live_files > live_files)
+      compact();
+  }
+  store();
+  is_indexing = false;
+}
+
+std::vector<IndexHit> NoteIndex::query(std::string_view q, size_t limit) {
+  std::vector<std::string> words{};
+  tokenize(q, [&](const std::string &term, uint32_t) {
+    if (words.size() < 32 && std::ranges::find(words, term) == words.end())
+      words.push_back(term);
+  });
+  if (words.empty())
+    return {};
+
+  std::shared_lock lock{mtx};
+  std::vector<const std::vector<Posting> *> lists{};
+  for (auto &word : words) {
+    auto it = term_ids.find(word);
+    if (it == term_ids.end())
+      return {};
+    lists.push_back(&postings[it->second]);
+  }
+  // Rarest term first so its first line in each file is the reported hit
+  std::ranges::sort(lists, {}, [](auto *l) { return l->size(); });
+
+  std::vector<float> scores(files.size(), 0.0f);
+  std::vector<uint8_t> matched(files.size(), 0);
+  std::vector<uint32_t> first_line(files.size(), 0);
+  // Postings of files that are not live wait for compaction
+  auto is_live = [&](const Posting &p) { return files[p.file].live; };
+  for (size_t t = 0; t < lists.size(); ++t) {
+    const auto &list = *lists[t];
+    size_t df = 0;
+    for (size_t i = 0; i < list.size(); ++i) {
+      if (is_live(list[i]) && (i == 0 || list[i - 1].file != list[i].file))
+        ++df;
+    }
+    if (df == 0)
+      return {};
+    float idf = std::log(1.0f + static_cast<float>(live_files) / df);
+    for (size_t i = 0; i < list.size(); ++i) {
+      const Posting &p = list[i];
+      if (!is_live(p) || matched[p.file] != t)
+        continue;
+      scores[p.file] += idf;
+      if (t == 0 && (i == 0 || list[i - 1].file != p.file))
+        first_line[p.file] = p.line;
+      if (i + 1 == list.size() || list[i + 1].file != p.file)
+        ++matched[p.file];
+    }
+  }
+
+  std::vector<IndexHit> hits{};
+  for (auto &p : *lists[0]) {
+    if (!is_live(p) || matched[p.file] != lists.size() ||
+        scores[p.file] == 0.0f)
+      continue;
+    hits.push_back({files[p.file].fp, first_line[p.file], scores[p.file]});
+    scores[p.file] = 0.0f;
+  }
+  size_t n = std::min(limit, hits.size());
+  std::partial_sort(hits.begin(), hits.begin() + n, hits.end(),
+                    [](auto &a, auto &b) { return a.score > b.score; });
+  hits.resize(n);
+  return hits;
+}
+
+// Layout, all integers as LEB128 varints:
+//   "TNIX" version
+//   file count, then per file: path (relative), mtime, size
+//   term count, then per term: bytes, posting count, (file delta, line)...
+void NoteIndex::store() {
+  std::string out{index_magic, sizeof(index_magic)};
+  write_varint(out, index_version);
+
+  std::shared_lock lock{mtx};
+  std::vector<uint32_t> remap(files.size(), UINT32_MAX);
+  uint32_t live_count{0};
+  for (uint32_t id = 0; id < files.size(); ++id) {
+    if (files[id].live)
+      remap[id] = live_count++;
+  }
+  write_varint(out, live_count);
+  for (auto &file : files) {
+    if (!file.live)
+      continue;
+    std::string rel = file.fp.lexically_relative(root).generic_string();
+    write_varint(out, rel.size());
+    out += rel;
+    write_varint(out, static_cast<uint64_t>(file.mtime));
+    write_varint(out, file.size);
+  }
+
+  write_varint(out, terms.size());
+  std::vector<Posting> sorted{};
+  for (uint32_t term = 0; term < terms.size(); ++term) {
+    write_varint(out, terms[term].size());
+    out += terms[term];
+    sorted.clear();
+    for (auto &p : postings[term]) {
+      if (remap[p.file] != UINT32_MAX)
+        sorted.push_back({remap[p.file], p.line});
+    }
+    std::ranges::sort(sorted, [](auto &a, auto &b) {
+      return a.file != b.file ? a.file < b.file : a.line < b.line;
+    });
+    write_varint(out, sorted.size());
+    uint32_t prev{0};
+    for (auto &p : sorted) {
+      write_varint(out, p.file - prev);
+      write_varint(out, p.line);
+      prev = p.file;
+    }
+  }
+  lock.unlock();
+
+  std::filesystem::path tmp = store_path;
+  tmp += ".tmp";
+  {
+    std::ofstream fs(tmp, std::ios::binary | std::ios::trunc);
+    if (!fs)
+      return;
+    fs.write(out.data(), out.size());
+    if (!fs)
+      return;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, store_path, ec);
+}
+
+bool NoteIndex::load() {
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(store_path, ec))
+    return false;
+  std::string in{read_file_binary(store_path)};
+  if (in.size() < sizeof(index_magic) ||
+      in.compare(0, sizeof(index_magic), index_magic, sizeof(index_magic)))
+    return false;
+
+  size_t pos{sizeof(index_magic)};
+  uint64_t version, count;
+  if (!read_varint(in, pos, version) || version != index_version)
+    return false;
+
+  std::vector<IndexedFile> loaded_files{};
+  if (!read_varint(in, pos, count))
+    return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t len, mtime, size;
+    if (!read_varint(in, pos, len) || len > in.size() - pos)
+      return false;
+    std::filesystem::path fp = root / in.substr(pos, len);
+    pos += len;
+    if (!read_varint(in, pos, mtime) || !read_varint(in, pos, size))
+      return false;
+    loaded_files.push_back({fp, static_cast<int64_t>(mtime), size, true});
+  }
+
+  std::vector<std::string> loaded_terms{};
+  std::vector<std::vector<Posting>> loaded_postings{};
+  if (!read_varint(in, pos, count))
+    return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t len, n;
+    if (!read_varint(in, pos, len) || len > in.size() - pos)
+      return false;
+    loaded_terms.emplace_back(in.substr(pos, len));
+    pos += len;
+    if (!read_varint(in, pos, n))
+      return false;
+    std::vector<Posting> &list = loaded_postings.emplace_back();
+    uint64_t file{0};
+    for (uint64_t k = 0; k < n; ++k) {
+      uint64_t delta, line;
+      if (!read_varint(in, pos, delta) || !read_varint(in, pos, line))
+        return false;
+      file += delta;
+      if (file >= loaded_files.size())
+        return false;
+      list.push_back(
+          {static_cast<uint32_t>(file), static_cast<uint32_t>(line)});
+    }
+  }
+
+  std::unique_lock lock{mtx};
+  files = std::move(loaded_files);
+  terms = std::move(loaded_terms);
+  postings = std::move(loaded_postings);
+  file_ids.clear();
+  term_ids.clear();
+  for (uint32_t id = 0; id < files.size(); ++id)
+    file_ids.emplace(files[id].fp, id);
+  for (uint32_t id = 0; id < terms.size(); ++id)
+    term_ids.emplace(terms[id], id);
+  live_files = files.size();
+  ++generation;
+  return true;
+}
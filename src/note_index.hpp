@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct IndexHit {
+  std::filesystem::path fp{};
+  uint32_t line{0};
+  float score{0};
+};
+
+// Inverted index over every text file below `root`. Indexing runs on a
+// background thread, fans file tokenization out across cores and is kept
+// in `root/.take-notes-index` so a restart only re-reads changed files.
+class NoteIndex {
+  struct Posting {
+    uint32_t file;
+    uint32_t line;
+  };
+  // A file that is not live is waiting to be indexed, or was removed or
+  // indexed again under a new id. Its postings stay behind until compact()
+  // drops them.
+  struct IndexedFile {
+    std::filesystem::path fp{};
+    int64_t mtime{0};
+    uint64_t size{0};
+    bool live{false};
+  };
+
+  std::filesystem::path root;
+  std::filesystem::path store_path;
+  std::shared_mutex mtx{};
+  std::vector<IndexedFile> files{};
+  std::unordered_map<std::filesystem::path, uint32_t> file_ids{};
+  std::unordered_map<std::string, uint32_t> term_ids{};
+  std::vector<std::string> terms{};
+  std::vector<std::vector<Posting>> postings{};
+  size_t live_files{0};
+
+  std::mutex wake_mtx{};
+  std::condition_variable_any wake_cv{};
+  bool wake{true};
+  // Set by set_root, taken up by the worker before its next scan
+  std::optional<std::filesystem::path> next_root{};
+
+  void run(std::stop_token stop);
+  void reroot(std::filesystem::path to);
+  void scan(std::stop_token stop);
+  uint32_t get_file_id(const std::filesystem::path &fp);
+  void remove_file(uint32_t id);
+  uint32_t renew_file(uint32_t id);
+  void compact();
+  void add_file(uint32_t id,
+                const std::vector<std::pair<std::string, uint32_t>> &toks);
+  bool load();
+  void store();
+
+public:
+  std::atomic<bool> is_indexing{false};
+  std::atomic<size_t> progress{0}, total{0};
+  // Bumped whenever the contents change, so callers can re-run queries
+  std::atomic<size_t> generation{0};
+
+  NoteIndex(std::filesystem::path root);
+  void refresh();
+  // Indexes below `root` from now on, starting from the index kept there
+  void set_root(const std::filesystem::path &root);
+  std::filesystem::path get_root();
+  std::vector<IndexHit> query(std::string_view q, size_t limit = 50);
+
+private:
+  // Last, so the thread stops before any state it touches is destroyed
+  std::jthread worker{};
+};
@@ -0,0 +1,150 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <imgui.h>
+
+static const size_t frame_history = 240;
+// Taken during static initialization, before main runs
+static const uint64_t launch_ns = Profiler::now_ns();
+
+Profiler &Profiler::get() {
+  static Profiler profiler{};
+  return profiler;
+}
+
+uint64_t Profiler::now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void StartupTrace::mark(const char *phase) {
+  if (!enabled)
+    return;
+  std::fprintf(stderr, "startup %9.3f ms  %s\n",
+               (Profiler::now_ns() - launch_ns) / 1e6, phase);
+}
+
+void Profiler::record(const char *name, uint64_t start) {
+  frame_events.push_back({name, start, now_ns() - start});
+}
+
+void Profiler::counter(const char *name, double value) {
+  for (auto &c : counters) {
+    if (!std::strcmp(c.name, name)) {
+      c.value = value;
+      return;
+    }
+  }
+  counters.push_back({name, value});
+}
+
+void Profiler::begin_frame() {
+  frame_events.clear();
+  frame_allocs = thread_alloc_stats();
+  frame_start = now_ns();
+}
+
+void Profiler::end_frame() {
+  uint64_t end = now_ns();
+  AllocStats allocs = thread_alloc_stats();
+  counter("allocations", allocs.count - frame_allocs.count);
+  counter("allocated bytes", allocs.bytes - frame_allocs.bytes);
+  if (frame_ms.size() < frame_history)
+    frame_ms.resize(frame_history, 0.0f);
+  frame_ms[frame_pos] = (end - frame_start) / 1e6f;
+  frame_pos = (frame_pos + 1) % frame_history;
+
+  for (auto &zone : zones) {
+    zone.calls = 0;
+    zone.ms = 0;
+  }
+  for (auto &ev : frame_events) {
+    auto it = std::find_if(zones.begin(), zones.end(), [&](auto &zone) {
+      return !std::strcmp(zone.name, ev.name);
+    });
+    if (it == zones.end()) {
+      zones.push_back({ev.name, 0, 0, 0});
+      it = zones.end() - 1;
+    }
+    ++it->calls;
+    it->ms += ev.dur_ns / 1e6;
+  }
+  for (auto &zone : zones)
+    zone.avg_ms = zone.avg_ms * 0.95 + zone.ms * 0.05;
+
+  if (capturing) {
+    trace.push_back({"Frame", frame_start, end - frame_start});
+    trace.insert(trace.end(), frame_events.begin(), frame_events.end());
+  }
+}
+
+void Profiler::render() {
+  ImGui::SetNextWindowBgAlpha(0.85f);
+  ImGui::Begin("Profiler", nullptr,
+               ImGuiWindowFlags_AlwaysAutoResize |
+                   ImGuiWindowFlags_NoFocusOnAppearing |
+                   ImGuiWindowFlags_NoNav);
+
+  float last = frame_ms.empty()
+                   ? 0.0f
+                   : frame_ms[(frame_pos + frame_history - 1) % frame_history];
+  ImGui::Text("Frame %.2f ms", last);
+  if (!frame_ms.empty()) {
+    ImGui::PlotHistogram("##Frames", frame_ms.data(), frame_ms.size(),
+                         frame_pos, nullptr, 0.0f, 33.3f, ImVec2(300, 60));
+  }
+
+  ImGui::Separator();
+  for (auto &zone : zones) {
+    ImGui::Text("%-20s %3u  %7.3f ms  avg %7.3f ms", zone.name, zone.calls,
+                zone.ms, zone.avg_ms);
+  }
+
+  ImGui::Separator();
+  for (auto &c : counters) {
+    ImGui::Text("%-20s %.0f", c.name, c.value);
+  }
+
+  ImGui::Separator();
+  if (!capturing && ImGui::Button("Start trace")) {
+    trace.clear();
+    capturing = true;
+    status.clear();
+  } else if (capturing && ImGui::Button("Stop and export")) {
+    capturing = false;
+    std::filesystem::path fp = std::filesystem::current_path() / "trace.json";
+    status = write_trace(fp) ? "Wrote " + fp.string() : "Failed to write trace";
+    trace.clear();
+  }
+  if (capturing) {
+    ImGui::SameLine();
+    ImGui::Text("%zu events", trace.size());
+  }
+  if (!status.empty()) {
+    ImGui::TextWrapped("%s", status.c_str());
+  }
+
+  ImGui::End();
+}
+
+// Chrome trace-event format, loadable in chrome://tracing or Perfetto
+bool Profiler::write_trace(const std::filesystem::path &fp) {
+  std::ofstream fs(fp, std::ios::trunc);
+  if (!fs)
+    return false;
+  uint64_t origin = trace.empty() ? 0 : trace.front().start_ns;
+  fs << "{\"traceEvents\":[";
+  for (size_t i = 0; i < trace.size(); ++i) {
+    const Event &ev = trace[i];
+    fs << (i ? ",\n" : "\n") << "{\"name\":\"" << ev.name
+       << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+       << (ev.start_ns - origin) / 1000.0 << ",\"dur\":" << ev.dur_ns / 1000.0
+       << "}";
+  }
+  fs << "\n]}\n";
+  return static_cast<bool>(fs);
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "alloc_stats.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Scoped timing zones for the main thread. A zone costs one branch on a
+// global flag while the profiler is off; building with NOTES_NO_PROFILER
+// removes them altogether.
+class Profiler {
+  struct Event {
+    const char *name;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+  };
+  struct Zone {
+    const char *name;
+    uint32_t calls;
+    double ms;
+    double avg_ms;
+  };
+  struct Counter {
+    const char *name;
+    double value;
+  };
+
+  std::vector<Event> frame_events{};
+  std::vector<Event> trace{};
+  std::vector<Zone> zones{};
+  std::vector<Counter> counters{};
+  std::vector<float> frame_ms{};
+  size_t frame_pos{0};
+  uint64_t frame_start{0};
+  AllocStats frame_allocs{};
+  bool capturing{false};
+  std::string status{};
+
+  bool write_trace(const std::filesystem::path &fp);
+
+public:
+  static inline bool enabled{false};
+
+  static Profiler &get();
+  static uint64_t now_ns();
+
+  void record(const char *name, uint64_t start);
+  void counter(const char *name, double value);
+  void begin_frame();
+  void end_frame();
+  void render();
+};
+
+// Startup timeline for --startup-trace. Each mark prints how long after
+// launch a phase finished, including steps deferred past the first frame.
+class StartupTrace {
+public:
+  static inline bool enabled{false};
+
+  static void mark(const char *phase);
+};
+
+class ProfileZone {
+  const char *name;
+  uint64_t start{0};
+  bool active;
+
+public:
+  ProfileZone(const char *name) : name(name), active(Profiler::enabled) {
+    if (active)
+      start = Profiler::now_ns();
+  }
+  ~ProfileZone() {
+    if (active)
+      Profiler::get().record(name, start);
+  }
+};
+
+#ifdef NOTES_NO_PROFILER
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE_CAT2(a, b) a##b
+#define PROFILE_ZONE_CAT(a, b) PROFILE_ZONE_CAT2(a, b)
+#define PROFILE_ZONE(name)                                                     \
+  ProfileZone PROFILE_ZONE_CAT(profile_zone_, __LINE__) { name }
+#endif
@@ -0,0 +1,234 @@
+#include "quick_open.hpp"
+#include <algorithm>
+#include <imgui.h>
+
+static const size_t max_paths = 2'000'000;
+static const size_t max_results = 50;
+
+static uint64_t char_bit(unsigned char c) {
+  if (c >= 'a' && c <= 'z')
+    return 1ull << (c - 'a');
+  if (c >= '0' && c <= '9')
+    return 1ull << (26 + c - '0');
+  if (c >= 0x80)
+    return 1ull << 63;
+  return 1ull << (36 + c % 27);
+}
+
+static unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Lowercase, without spaces, as paths are matched
+static std::string fold_query(std::string_view raw) {
+  std::string q{};
+  for (unsigned char c : raw) {
+    if (c != ' ')
+      q += fold(c);
+  }
+  return q;
+}
+
+static bool is_separator(unsigned char c) {
+  return c == '/' || c == '_' || c == '-' || c == '.' || c == ' ';
+}
+
+// Greedy subsequence match. Consecutive runs, word starts and hits inside
+// the file name score higher; longer paths lose a little.
+static int fuzzy_score(std::string_view path, std::string_view q,
+                       size_t name_start) {
+  int score{0};
+  size_t qi{0};
+  size_t prev{std::string_view::npos};
+  for (size_t i = 0; i < path.size() && qi < q.size(); ++i) {
+    if (path[i] != q[qi])
+      continue;
+    score += 1;
+    if (prev != std::string_view::npos && prev + 1 == i)
+      score += 5;
+    if (i == 0 || is_separator(path[i - 1]))
+      score += 8;
+    if (i >= name_start)
+      score += 2;
+    prev = i;
+    ++qi;
+  }
+  if (qi != q.size())
+    return -1;
+  return score * 16 - static_cast<int>(std::min<size_t>(path.size(), 255));
+}
+
+std::string_view PathArena::get(size_t i) const {
+  return std::string_view{text}.substr(starts[i], starts[i + 1] - starts[i]);
+}
+
+void QuickOpen::show() {
+  is_open = true;
+  focus = true;
+  selected = 0;
+  // Rescan every time so files created since the last open show up; the
+  // previous arena stays searchable until the new one is ready
+  if (!is_scanning) {
+    is_scanning = true;
+    tasks.run(TaskPriority::Background,
+              [this, root = explorer.get_root()](std::stop_token stop) {
+                scan(root, stop);
+              });
+  }
+}
+
+void QuickOpen::scan(std::filesystem::path root, std::stop_token stop) {
+  auto paths = std::make_shared<PathArena>();
+  paths->root = root;
+  std::error_code ec;
+  auto it = std::filesystem::recursive_directory_iterator(
+      root, std::filesystem::directory_options::skip_permission_denied, ec);
+  for (auto end = std::filesystem::recursive_directory_iterator();
+       !ec && it != end && paths->size() < max_paths; it.increment(ec)) {
+    if (stop.stop_requested())
+      return;
+    std::string name = it->path().filename().string();
+    // An error on one entry skips it; only the iterator's own errors end
+    // the walk
+    std::error_code entry_ec;
+    if (!name.empty() && name[0] == '.') {
+      if (it->is_directory(entry_ec))
+        it.disable_recursion_pending();
+      continue;
+    }
+    if (!it->is_regular_file(entry_ec))
+      continue;
+    std::string rel = it->path().lexically_relative(root).generic_string();
+    uint64_t mask{0};
+    for (unsigned char c : rel) {
+      c = fold(c);
+      paths->folded += c;
+      mask |= char_bit(c);
+    }
+    paths->name_starts.push_back(paths->text.size() + rel.size() -
+                                 name.size());
+    paths->text += rel;
+    paths->starts.push_back(paths->text.size());
+    paths->masks.push_back(mask);
+  }
+
+  std::lock_guard lock{mtx};
+  arena = std::move(paths);
+  ++arena_generation;
+  is_scanning = false;
+}
+
+void QuickOpen::update_results(const PathArena &paths, size_t generation,
+                               std::string &&q) {
+  uint64_t qmask{0};
+  for (unsigned char c : q)
+    qmask |= char_bit(c);
+
+  // Typing more characters can only shrink the match set, so narrow the
+  // previous candidates instead of rescanning the whole arena
+  bool narrowing = last_generation == generation && !last_query.empty() &&
+                   q.starts_with(last_query);
+  if (!narrowing) {
+    candidates.resize(paths.size());
+    for (uint32_t i = 0; i < candidates.size(); ++i)
+      candidates[i] = i;
+  }
+
+  size_t kept{0};
+  for (uint32_t idx : candidates) {
+    candidates[kept] = idx;
+    kept += (paths.masks[idx] & qmask) == qmask;
+  }
+  candidates.resize(kept);
+
+  results.clear();
+  kept = 0;
+  std::string_view folded{paths.folded};
+  for (uint32_t idx : candidates) {
+    uint32_t start = paths.starts[idx];
+    std::string_view path = folded.substr(start, paths.starts[idx + 1] - start);
+    int score = fuzzy_score(path, q, paths.name_starts[idx] - start);
+    if (score < 0)
+      continue;
+    candidates[kept++] = idx;
+    results.emplace_back(score, idx);
+  }
+  candidates.resize(kept);
+
+  size_t n = std::min(max_results, results.size());
+  std::partial_sort(results.begin(), results.begin() + n, results.end(),
+                    [](auto &a, auto &b) { return a.first > b.first; });
+  results.resize(n);
+  if (selected >= results.size())
+    selected = 0;
+  last_query = std::move(q);
+  last_generation = generation;
+}
+
+void QuickOpen::render() {
+  if (!is_open)
+    return;
+
+  std::shared_ptr<const PathArena> paths;
+  size_t generation;
+  {
+    std::lock_guard lock{mtx};
+    paths = arena;
+    generation = arena_generation;
+  }
+
+  ImGuiIO &io = ImGui::GetIO();
+  float w = std::min(600.0f, io.DisplaySize.x - 40.0f);
+  ImGui::SetNextWindowPos({(io.DisplaySize.x - w) / 2, 40.0f});
+  ImGui::SetNextWindowSize({w, 0});
+  ImGui::Begin("Quick Open", nullptr,
+               ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+                   ImGuiWindowFlags_AlwaysAutoResize);
+
+  if (focus) {
+    ImGui::SetKeyboardFocusHere();
+    focus = false;
+  }
+  bool submit = ImGui::InputText("##Query", query.data(), query.size(),
+                                 ImGuiInputTextFlags_EnterReturnsTrue);
+  std::string q{fold_query(query.c_str())};
+  if (q != last_query || generation != last_generation) {
+    update_results(*paths, generation, std::move(q));
+  }
+
+  if (ImGui::IsKeyPressed(ImGuiKey_DownArrow) &&
+      selected + 1 < results.size()) {
+    ++selected;
+  }
+  if (ImGui::IsKeyPressed(ImGuiKey_UpArrow) && selected > 0) {
+    --selected;
+  }
+
+  if (is_scanning) {
+    ImGui::TextDisabled("Indexing... %zu files", paths->size());
+  }
+
+  std::filesystem::path chosen{};
+  for (size_t i = 0; i < results.size(); ++i) {
+    std::string label{paths->get(results[i].second)};
+    ImGui::PushID(i);
+    if (ImGui::Selectable(label.c_str(), i == selected)) {
+      chosen = paths->root / label;
+    }
+    ImGui::PopID();
+  }
+  if (submit && selected < results.size()) {
+    chosen = paths->root / paths->get(results[selected].second);
+  }
+
+  if (ImGui::IsKeyPressed(ImGuiKey_Escape)) {
+    is_open = false;
+  }
+
+  ImGui::End();
+
+  if (!chosen.empty()) {
+    is_open = false;
+    explorer.open(chosen);
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "file_exp.hpp"
+#include "task_pool.hpp"
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Every file below a root, stored back to back in one buffer so a query
+// walks contiguous memory instead of chasing path objects.
+struct PathArena {
+  std::filesystem::path root{};
+  std::string text{};
+  std::string folded{};
+  std::vector<uint32_t> starts{0};
+  std::vector<uint32_t> name_starts{};
+  // Which characters each path contains, checked before scoring
+  std::vector<uint64_t> masks{};
+
+  size_t size() const { return masks.size(); }
+  std::string_view get(size_t i) const;
+};
+
+class QuickOpen {
+  FileExplorer &explorer;
+  std::mutex mtx{};
+  std::shared_ptr<const PathArena> arena{std::make_shared<PathArena>()};
+  // Bumped with each new arena, which may reuse a freed one's address
+  size_t arena_generation{0};
+  std::atomic<bool> is_scanning{false};
+  std::string query{};
+  // Folded query and arena the candidates and results were found for
+  std::string last_query{};
+  std::optional<size_t> last_generation{};
+  std::vector<uint32_t> candidates{};
+  std::vector<std::pair<int, uint32_t>> results{};
+  size_t selected{0};
+  bool focus{false};
+
+  void scan(std::filesystem::path root, std::stop_token stop);
+  void update_results(const PathArena &paths, size_t generation,
+                      std::string &&q);
+
+public:
+  bool is_open{false};
+  QuickOpen(FileExplorer &explorer) : explorer(explorer) {
+    query.resize(1024);
+  }
+  void show();
+  void render();
+
+private:
+  // Last, so a running scan finishes before the state it writes to is
+  // destroyed
+  TaskGroup tasks{};
+};
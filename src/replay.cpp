@@ -0,0 +1,151 @@
+#include "replay.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+EventRecorder::EventRecorder(const std::filesystem::path &fp,
+                             SDL_Window *window)
+    : out(fp, std::ios::trunc) {
+  int w, h;
+  SDL_GetWindowSize(window, &w, &h);
+  out << "size " << w << " " << h << "\n";
+}
+
+void EventRecorder::record(const SDL_Event &event) {
+  switch (event.type) {
+  case SDL_EVENT_KEY_DOWN:
+    out << "key " << event.key.key << " " << event.key.mod << "\n";
+    break;
+  case SDL_EVENT_TEXT_INPUT: {
+    out << "text ";
+    for (const char *c = event.text.text; *c; ++c) {
+      char hex[3];
+      std::snprintf(hex, sizeof(hex), "%02x", static_cast<unsigned char>(*c));
+      out << hex;
+    }
+    out << "\n";
+  } break;
+  case SDL_EVENT_MOUSE_WHEEL:
+    // Fractional, since touchpads scroll by less than a notch
+    out << "wheel " << event.wheel.y << " " << SDL_GetModState() << "\n";
+    break;
+  case SDL_EVENT_MOUSE_BUTTON_DOWN:
+    out << "click " << static_cast<int>(event.button.button) << " "
+        << static_cast<int>(event.button.clicks) << " " << event.button.x
+        << " " << event.button.y << "\n";
+    break;
+  default:
+    return;
+  }
+  out.flush();
+}
+
+struct Sample {
+  double event_ms;
+  double total_ms;
+};
+
+static void report(const std::string &type, std::vector<Sample> &samples) {
+  auto percentile = [&](std::vector<double> &v, double p) {
+    size_t i = std::min(v.size() - 1, static_cast<size_t>(v.size() * p));
+    return v[i];
+  };
+  std::vector<double> event_ms{}, total_ms{};
+  for (auto &s : samples) {
+    event_ms.push_back(s.event_ms);
+    total_ms.push_back(s.total_ms);
+  }
+  std::sort(event_ms.begin(), event_ms.end());
+  std::sort(total_ms.begin(), total_ms.end());
+  std::printf("%-6s %6zu  %8.3f %8.3f %8.3f  %8.3f %8.3f %8.3f\n",
+              type.c_str(), samples.size(), percentile(event_ms, 0.5),
+              percentile(event_ms, 0.99), event_ms.back(),
+              percentile(total_ms, 0.5), percentile(total_ms, 0.99),
+              total_ms.back());
+}
+
+int replay_events(const std::filesystem::path &fp, SDL_Window *window,
+                  Tabs &tabs, std::function<void()> frame) {
+  std::ifstream in(fp);
+  if (!in) {
+    std::fprintf(stderr, "Cannot open recording '%s'\n", fp.string().c_str());
+    return 1;
+  }
+
+  // Let any background parse of the opened document land first
+  for (int i = 0; i < 1000 && tabs.current().is_loading(); ++i) {
+    frame();
+    SDL_Delay(1);
+  }
+
+  std::map<std::string, std::vector<Sample>> samples{};
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string type;
+    ls >> type;
+
+    SDL_Event event{};
+    std::string text{};
+    if (type == "size") {
+      int w, h;
+      ls >> w >> h;
+      SDL_SetWindowSize(window, w, h);
+      frame();
+      continue;
+    } else if (type == "key") {
+      Uint32 key, mod;
+      ls >> key >> mod;
+      event.type = SDL_EVENT_KEY_DOWN;
+      event.key.key = key;
+      event.key.mod = static_cast<SDL_Keymod>(mod);
+      event.key.down = true;
+    } else if (type == "text") {
+      std::string hex;
+      ls >> hex;
+      for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        text += static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16));
+      event.type = SDL_EVENT_TEXT_INPUT;
+      event.text.text = text.c_str();
+    } else if (type == "wheel") {
+      // Wheel events carry no modifiers, so Ctrl for zoom is recorded
+      // alongside; older recordings leave it out
+      Uint32 mod{0};
+      event.type = SDL_EVENT_MOUSE_WHEEL;
+      ls >> event.wheel.y >> mod;
+      event.wheel.integer_y = static_cast<int>(event.wheel.y);
+      SDL_SetModState(static_cast<SDL_Keymod>(mod));
+    } else if (type == "click") {
+      int button, clicks;
+      event.type = SDL_EVENT_MOUSE_BUTTON_DOWN;
+      ls >> button >> clicks >> event.button.x >> event.button.y;
+      event.button.button = static_cast<Uint8>(button);
+      event.button.clicks = static_cast<Uint8>(clicks);
+      event.button.down = true;
+    } else {
+      continue;
+    }
+
+    // Without real input the editor window never gains focus on its own
+    tabs.current().is_focused = true;
+    auto start = std::chrono::steady_clock::now();
+    tabs.event(event);
+    SDL_SetModState(SDL_KMOD_NONE);
+    auto handled = std::chrono::steady_clock::now();
+    frame();
+    auto end = std::chrono::steady_clock::now();
+    samples[type].push_back(
+        {std::chrono::duration<double, std::milli>(handled - start).count(),
+         std::chrono::duration<double, std::milli>(end - start).count()});
+  }
+
+  std::printf("%-6s %6s  %8s %8s %8s  %8s %8s %8s\n", "type", "count",
+              "ev p50", "ev p99", "ev max", "tot p50", "tot p99", "tot max");
+  for (auto &[type, list] : samples)
+    report(type, list);
+  return 0;
+}
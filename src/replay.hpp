@@ -0,0 +1,22 @@
+#pragma once
+#include "tabs.hpp"
+#include <SDL3/SDL.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+
+// Writes the events the editor consumes to a plain text file, one per
+// line, preceded by the window size.
+class EventRecorder {
+  std::ofstream out;
+
+public:
+  EventRecorder(const std::filesystem::path &fp, SDL_Window *window);
+  bool is_open() { return out.is_open(); }
+  void record(const SDL_Event &event);
+};
+
+// Plays a recording into `tabs`, one event per frame, and prints
+// p50/p99/max latency per event type. `frame` draws and presents a frame.
+int replay_events(const std::filesystem::path &fp, SDL_Window *window,
+                  Tabs &tabs, std::function<void()> frame);
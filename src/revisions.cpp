@@ -0,0 +1,554 @@
+#include "revisions.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <imgui.h>
+
+static constexpr std::string_view log_magic{"TNRV"};
+static constexpr uint64_t log_version{1};
+
+// Content-defined chunking with a gear hash: a cut falls wherever the top
+// bits of the hash over the last 64 bytes are zero, so inserting text only
+// moves the cuts next to it. Chunks average about 8 KiB past the minimum.
+static constexpr size_t min_chunk{2 * 1024}, max_chunk{64 * 1024};
+static constexpr int cut_bits{13};
+
+static const std::array<uint64_t, 256> gear = []() {
+  std::array<uint64_t, 256> table{};
+  uint64_t x{0x9E3779B97F4A7C15};
+  for (auto &v : table) {
+    // splitmix64
+    uint64_t z = (x += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    v = z ^ (z >> 31);
+  }
+  return table;
+}();
+
+static size_t next_cut(std::string_view s, size_t start) {
+  size_t end = std::min(s.size(), start + max_chunk);
+  if (end - start <= min_chunk)
+    return end;
+  uint64_t h{0};
+  for (size_t i = start + min_chunk; i < end; ++i) {
+    h = (h << 1) + gear[static_cast<unsigned char>(s[i])];
+    if ((h >> (64 - cut_bits)) == 0)
+      return i + 1;
+  }
+  return end;
+}
+
+RevisionStore::RevisionStore(std::filesystem::path root)
+    : dir(root / ".take-notes-history"), log_path(dir / "revisions"),
+      pack_path(dir / "chunks") {
+  worker = std::jthread([this](std::stop_token stop) {
+    load();
+    while (true) {
+      std::vector<std::filesystem::path> batch{};
+      {
+        std::unique_lock lock{queue_mtx};
+        if (!queue_cv.wait(lock, stop, [&]() { return !queue.empty(); }))
+          return;
+        batch.swap(queue);
+      }
+      for (auto &fp : batch) {
+        if (stop.stop_requested())
+          return;
+        // A file deleted since it was saved records nothing
+        std::error_code ec;
+        std::string text{read_file_binary(fp, ec)};
+        if (!ec)
+          store(fp, text);
+      }
+    }
+  });
+}
+
+std::string RevisionStore::key(const std::filesystem::path &fp) {
+  std::error_code ec;
+  return std::filesystem::absolute(fp, ec).lexically_normal().generic_string();
+}
+
+void RevisionStore::record(const std::filesystem::path &fp) {
+  if (fp.empty())
+    return;
+  std::lock_guard lock{queue_mtx};
+  if (std::find(queue.begin(), queue.end(), fp) == queue.end())
+    queue.push_back(fp);
+  queue_cv.notify_one();
+}
+
+// Log layout: "TNRV" version, then records, all integers as varints:
+//   'C' offset size hash       a chunk appended to the pack
+//   'R' path_len path time size count chunk_ids...
+// A torn record at the end, from a crash mid-save, is cut off on load.
+void RevisionStore::load() {
+  std::error_code ec;
+  uint64_t packed = std::filesystem::file_size(pack_path, ec);
+  if (ec)
+    packed = 0;
+  std::string log{};
+  if (std::filesystem::is_regular_file(log_path, ec))
+    log = read_file_binary(log_path);
+  std::string_view in{log};
+  size_t pos{0}, good{0};
+  uint64_t version{0};
+
+  std::vector<Chunk> loaded{};
+  std::unordered_map<uint64_t, std::vector<uint32_t>> ids{};
+  std::unordered_map<std::string, std::vector<Revision>> revs{};
+  uint64_t logical{0};
+  if (in.starts_with(log_magic)) {
+    pos = log_magic.size();
+    if (read_varint(in, pos, version) && version == log_version)
+      good = pos;
+  }
+  while (good && pos < in.size()) {
+    char tag = in[pos++];
+    if (tag == 'C') {
+      uint64_t offset, size, hash;
+      if (!read_varint(in, pos, offset) || !read_varint(in, pos, size) ||
+          !read_varint(in, pos, hash) || offset > packed ||
+          size > packed - offset)
+        break;
+      ids[hash].push_back(static_cast<uint32_t>(loaded.size()));
+      loaded.push_back({offset, size});
+    } else if (tag == 'R') {
+      uint64_t len, time, size, count;
+      if (!read_varint(in, pos, len) || len > in.size() - pos)
+        break;
+      std::string path{in.substr(pos, len)};
+      pos += len;
+      if (!read_varint(in, pos, time) || !read_varint(in, pos, size) ||
+          !read_varint(in, pos, count) || count > in.size() - pos)
+        break;
+      Revision rev{static_cast<int64_t>(time), size, {}};
+      bool ok{true};
+      for (uint64_t i = 0; i < count && ok; ++i) {
+        uint64_t id;
+        ok = read_varint(in, pos, id) && id < loaded.size();
+        rev.chunks.push_back(static_cast<uint32_t>(id));
+      }
+      if (!ok)
+        break;
+      logical += size;
+      revs[path].push_back(std::move(rev));
+    } else {
+      break;
+    }
+    good = pos;
+  }
+
+  if (!good) {
+    // Missing or unreadable: start over
+    std::filesystem::create_directories(dir, ec);
+    std::string header{log_magic};
+    write_varint(header, log_version);
+    std::ofstream fs(log_path, std::ios::binary | std::ios::trunc);
+    fs << header;
+  } else if (good < in.size()) {
+    std::filesystem::resize_file(log_path, good, ec);
+  }
+
+  std::lock_guard lock{mtx};
+  chunks = std::move(loaded);
+  chunk_ids = std::move(ids);
+  revisions = std::move(revs);
+  pack_size = packed;
+  logical_size = logical;
+  ++generation;
+}
+
+void RevisionStore::store(const std::filesystem::path &fp,
+                          std::string_view text) {
+  // Only this thread writes, so reads here need no lock
+  std::string path = key(fp);
+  std::ifstream pack(pack_path, std::ios::binary);
+  // New chunks go at the real end of the pack, even if an earlier write
+  // was cut short
+  std::error_code ec;
+  uint64_t base = std::filesystem::file_size(pack_path, ec);
+  if (ec)
+    base = 0;
+  std::string fresh{}, existing{}, records{};
+  std::vector<Chunk> added{};
+  std::unordered_map<uint64_t, std::vector<uint32_t>> added_ids{};
+  Revision rev{};
+  rev.time = std::chrono::duration_cast<std::chrono::seconds>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count();
+  rev.size = text.size();
+
+  for (size_t start = 0; start < text.size();) {
+    size_t end = next_cut(text, start);
+    std::string_view piece = text.substr(start, end - start);
+    start = end;
+    uint64_t hash = hash_bytes(piece);
+
+    // Equal hashes are compared byte for byte before sharing a chunk
+    std::optional<uint32_t> id{};
+    if (auto it = chunk_ids.find(hash); it != chunk_ids.end()) {
+      for (uint32_t cand : it->second) {
+        const Chunk &c = chunks[cand];
+        if (c.size != piece.size())
+          continue;
+        existing.resize(c.size);
+        pack.seekg(c.offset);
+        if (pack.read(existing.data(), c.size) && existing == piece) {
+          id = cand;
+          break;
+        }
+        pack.clear();
+      }
+    }
+    if (auto it = added_ids.find(hash); !id && it != added_ids.end()) {
+      for (uint32_t cand : it->second) {
+        const Chunk &c = added[cand - chunks.size()];
+        if (std::string_view{fresh}.substr(c.offset - base, c.size) ==
+            piece) {
+          id = cand;
+          break;
+        }
+      }
+    }
+    if (!id) {
+      id = static_cast<uint32_t>(chunks.size() + added.size());
+      Chunk c{base + fresh.size(), piece.size()};
+      fresh += piece;
+      records += 'C';
+      write_varint(records, c.offset);
+      write_varint(records, c.size);
+      write_varint(records, hash);
+      added.push_back(c);
+      added_ids[hash].push_back(*id);
+    }
+    rev.chunks.push_back(*id);
+  }
+
+  if (auto it = revisions.find(path);
+      it != revisions.end() && it->second.back().chunks == rev.chunks)
+    return;
+
+  records += 'R';
+  write_varint(records, path.size());
+  records += path;
+  write_varint(records, static_cast<uint64_t>(rev.time));
+  write_varint(records, rev.size);
+  write_varint(records, rev.chunks.size());
+  for (uint32_t id : rev.chunks)
+    write_varint(records, id);
+
+  // Chunk data first, so the log never points past the end of the pack
+  {
+    std::ofstream out(pack_path, std::ios::binary | std::ios::app);
+    out.write(fresh.data(), fresh.size());
+    if (!out.flush())
+      return;
+  }
+  {
+    std::ofstream out(log_path, std::ios::binary | std::ios::app);
+    out.write(records.data(), records.size());
+    if (!out.flush())
+      return;
+  }
+
+  std::lock_guard lock{mtx};
+  for (auto &[hash, ids] : added_ids)
+    chunk_ids[hash].insert(chunk_ids[hash].end(), ids.begin(), ids.end());
+  chunks.insert(chunks.end(), added.begin(), added.end());
+  pack_size = base + fresh.size();
+  logical_size += rev.size;
+  revisions[path].push_back(std::move(rev));
+  ++generation;
+}
+
+std::vector<Revision> RevisionStore::list(const std::filesystem::path &fp) {
+  std::lock_guard lock{mtx};
+  auto it = revisions.find(key(fp));
+  if (it == revisions.end())
+    return {};
+  return it->second;
+}
+
+std::optional<std::string> RevisionStore::read(const Revision &rev) {
+  std::vector<Chunk> refs{};
+  {
+    std::lock_guard lock{mtx};
+    for (uint32_t id : rev.chunks) {
+      if (id >= chunks.size())
+        return std::nullopt;
+      refs.push_back(chunks[id]);
+    }
+  }
+  std::ifstream pack(pack_path, std::ios::binary);
+  std::string out(rev.size, '\0');
+  size_t pos{0};
+  for (const Chunk &c : refs) {
+    if (c.size > out.size() - pos)
+      return std::nullopt;
+    pack.seekg(c.offset);
+    if (!pack.read(out.data() + pos, c.size))
+      return std::nullopt;
+    pos += c.size;
+  }
+  if (pos != out.size())
+    return std::nullopt;
+  return out;
+}
+
+std::pair<uint64_t, uint64_t> RevisionStore::usage() {
+  std::lock_guard lock{mtx};
+  return {pack_size, logical_size};
+}
+
+static std::vector<std::string_view> split_lines(std::string_view s) {
+  std::vector<std::string_view> lines{};
+  size_t start{0};
+  while (start < s.size()) {
+    size_t end = s.find('\n', start);
+    if (end == s.npos)
+      end = s.size();
+    lines.push_back(s.substr(start, end - start));
+    start = end + 1;
+  }
+  return lines;
+}
+
+// Edits past this many make the middle a plain replacement, which keeps
+// the Myers trace, O(edits^2), bounded
+static constexpr int max_edits{2000};
+
+// Every line of `a` and `b` in order, each kept (' '), removed ('-') or
+// added ('+')
+static std::vector<std::pair<char, std::string_view>>
+line_script(const std::vector<std::string_view> &a,
+            const std::vector<std::string_view> &b) {
+  // Most saves touch one spot, so trim the common ends before searching
+  size_t head{0};
+  while (head < a.size() && head < b.size() && a[head] == b[head])
+    ++head;
+  size_t tail{0};
+  while (tail < a.size() - head && tail < b.size() - head &&
+         a[a.size() - 1 - tail] == b[b.size() - 1 - tail])
+    ++tail;
+
+  std::vector<uint64_t> ha{}, hb{};
+  for (size_t i = head; i < a.size() - tail; ++i)
+    ha.push_back(hash_bytes(a[i]));
+  for (size_t i = head; i < b.size() - tail; ++i)
+    hb.push_back(hash_bytes(b[i]));
+  int n = static_cast<int>(ha.size()), m = static_cast<int>(hb.size());
+  auto same = [&](int x, int y) {
+    return ha[x] == hb[y] && a[head + x] == b[head + y];
+  };
+
+  // Edit script over the middle, built backwards
+  std::vector<std::pair<char, std::string_view>> middle{};
+  std::vector<std::vector<int>> trace{};
+  int limit = std::min(n + m, max_edits);
+  std::vector<int> v(2 * limit + 3, 0);
+  int offset = limit + 1, found{-1};
+  for (int d = 0; d <= limit && found < 0; ++d) {
+    trace.emplace_back(v.begin() + offset - d - 1, v.begin() + offset + d + 2);
+    for (int k = -d; k <= d; k += 2) {
+      int x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                  ? v[offset + k + 1]
+                  : v[offset + k - 1] + 1;
+      int y = x - k;
+      while (x < n && y < m && same(x, y)) {
+        ++x;
+        ++y;
+      }
+      v[offset + k] = x;
+      if (x >= n && y >= m) {
+        found = d;
+        break;
+      }
+    }
+  }
+
+  if (found < 0) {
+    for (int y = m - 1; y >= 0; --y)
+      middle.emplace_back('+', b[head + y]);
+    for (int x = n - 1; x >= 0; --x)
+      middle.emplace_back('-', a[head + x]);
+  } else {
+    int x = n, y = m;
+    for (int d = found; d >= 0; --d) {
+      const std::vector<int> &tv = trace[d];
+      auto at = [&](int k) { return tv[k + d + 1]; };
+      int k = x - y;
+      int prev_k =
+          (k == -d || (k != d && at(k - 1) < at(k + 1))) ? k + 1 : k - 1;
+      int prev_x = d == 0 ? 0 : at(prev_k);
+      int prev_y = d == 0 ? 0 : prev_x - prev_k;
+      while (x > prev_x && y > prev_y) {
+        --x;
+        --y;
+        middle.emplace_back(' ', a[head + x]);
+      }
+      if (d == 0)
+        break;
+      if (x == prev_x)
+        middle.emplace_back('+', b[head + prev_y]);
+      else
+        middle.emplace_back('-', a[head + prev_x]);
+      x = prev_x;
+      y = prev_y;
+    }
+  }
+  std::reverse(middle.begin(), middle.end());
+
+  std::vector<std::pair<char, std::string_view>> script{};
+  for (size_t i = 0; i < head; ++i)
+    script.emplace_back(' ', a[i]);
+  script.insert(script.end(), middle.begin(), middle.end());
+  for (size_t i = a.size() - tail; i < a.size(); ++i)
+    script.emplace_back(' ', a[i]);
+  return script;
+}
+
+std::vector<DiffLine> diff_lines(std::string_view from, std::string_view to,
+                                 size_t context) {
+  auto script = line_script(split_lines(from), split_lines(to));
+
+  // Collapse long unchanged runs, keeping `context` lines around changes
+  std::vector<DiffLine> out{};
+  for (size_t i = 0; i < script.size();) {
+    if (script[i].first != ' ') {
+      out.push_back({script[i].first, std::string(script[i].second)});
+      ++i;
+      continue;
+    }
+    size_t j = i;
+    while (j < script.size() && script[j].first == ' ')
+      ++j;
+    size_t keep_front = i == 0 ? 0 : context;
+    size_t keep_back = j == script.size() ? 0 : context;
+    if (j - i > keep_front + keep_back + 1) {
+      for (size_t k = i; k < i + keep_front; ++k)
+        out.push_back({' ', std::string(script[k].second)});
+      out.push_back(
+          {'@', std::to_string(j - i - keep_front - keep_back)});
+      for (size_t k = j - keep_back; k < j; ++k)
+        out.push_back({' ', std::string(script[k].second)});
+    } else {
+      for (size_t k = i; k < j; ++k)
+        out.push_back({' ', std::string(script[k].second)});
+    }
+    i = j;
+  }
+  return out;
+}
+
+namespace {
+// Lines [begin, end) of the base replaced by `lines`
+struct Hunk {
+  size_t begin{0}, end{0};
+  std::vector<std::string_view> lines{};
+  bool operator==(const Hunk &) const = default;
+};
+} // namespace
+
+static std::vector<Hunk> line_hunks(const std::vector<std::string_view> &base,
+                                    const std::vector<std::string_view> &to) {
+  std::vector<Hunk> hunks{};
+  size_t line{0};
+  bool is_open{false};
+  for (auto &[kind, text] : line_script(base, to)) {
+    if (kind == ' ') {
+      is_open = false;
+      ++line;
+      continue;
+    }
+    if (!is_open)
+      hunks.push_back({line, line, {}});
+    is_open = true;
+    if (kind == '-')
+      hunks.back().end = ++line;
+    else
+      hunks.back().lines.push_back(text);
+  }
+  return hunks;
+}
+
+std::optional<std::string> merge_lines(std::string_view base,
+                                       std::string_view mine,
+                                       std::string_view theirs) {
+  std::vector<std::string_view> lines = split_lines(base);
+  std::vector<Hunk> a = line_hunks(lines, split_lines(mine));
+  std::vector<Hunk> b = line_hunks(lines, split_lines(theirs));
+
+  // Hunks from both sides in base order. Two that start together or
+  // overlap conflict unless they are the same change.
+  std::vector<const Hunk *> order{};
+  size_t i{0}, j{0};
+  while (i < a.size() || j < b.size()) {
+    if (j == b.size() || (i < a.size() && a[i].begin < b[j].begin &&
+                          a[i].end <= b[j].begin)) {
+      order.push_back(&a[i++]);
+    } else if (i == a.size() || (b[j].begin < a[i].begin &&
+                                 b[j].end <= a[i].begin)) {
+      order.push_back(&b[j++]);
+    } else if (a[i] == b[j]) {
+      order.push_back(&a[i++]);
+      ++j;
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  std::string out{};
+  bool is_first{true};
+  auto emit = [&](std::string_view line) {
+    if (!is_first)
+      out += '\n';
+    out.append(line);
+    is_first = false;
+  };
+  size_t line{0};
+  for (const Hunk *hunk : order) {
+    for (; line < hunk->begin; ++line)
+      emit(lines[line]);
+    for (std::string_view added : hunk->lines)
+      emit(added);
+    line = hunk->end;
+  }
+  for (; line < lines.size(); ++line)
+    emit(lines[line]);
+  // Lines are split without their newline, so the final one is decided
+  // like any other change
+  bool base_nl = base.ends_with('\n'), theirs_nl = theirs.ends_with('\n');
+  bool has_nl = theirs_nl != base_nl ? theirs_nl : mine.ends_with('\n');
+  if (has_nl && !is_first)
+    out += '\n';
+  return out;
+}
+
+void render_diff(const std::vector<DiffLine> &lines) {
+  ImGuiListClipper clipper;
+  clipper.Begin(static_cast<int>(lines.size()));
+  while (clipper.Step()) {
+    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+      const DiffLine &line = lines[i];
+      switch (line.kind) {
+      case '+':
+        ImGui::TextColored({0.2f, 0.7f, 0.2f, 1.0f}, "+ %s",
+                           line.text.c_str());
+        break;
+      case '-':
+        ImGui::TextColored({0.8f, 0.2f, 0.2f, 1.0f}, "- %s",
+                           line.text.c_str());
+        break;
+      case '@':
+        ImGui::TextDisabled("  ... %s unchanged lines", line.text.c_str());
+        break;
+      default:
+        ImGui::Text("  %s", line.text.c_str());
+      }
+    }
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Revision {
+  // Seconds since the epoch
+  int64_t time{0};
+  uint64_t size{0};
+  std::vector<uint32_t> chunks{};
+};
+
+// Every saved version of every note below `root`, kept in
+// `root/.take-notes-history`. Contents are split with content-defined
+// chunking, so an edit only changes the chunks around it, and chunks are
+// stored once by hash. A revision is the list of its chunks. Recording
+// runs on a background thread.
+class RevisionStore {
+  struct Chunk {
+    uint64_t offset{0}, size{0};
+  };
+
+  std::filesystem::path dir, log_path, pack_path;
+  std::mutex mtx{};
+  std::vector<Chunk> chunks{};
+  std::unordered_map<uint64_t, std::vector<uint32_t>> chunk_ids{};
+  std::unordered_map<std::string, std::vector<Revision>> revisions{};
+  uint64_t pack_size{0}, logical_size{0};
+
+  std::mutex queue_mtx{};
+  std::condition_variable_any queue_cv{};
+  std::vector<std::filesystem::path> queue{};
+
+  static std::string key(const std::filesystem::path &fp);
+  void load();
+  void store(const std::filesystem::path &fp, std::string_view text);
+
+public:
+  // Bumped whenever a revision is added
+  std::atomic<size_t> generation{0};
+
+  RevisionStore(std::filesystem::path root);
+  // Snapshots the file as it is on disk now
+  void record(const std::filesystem::path &fp);
+  // Oldest first
+  std::vector<Revision> list(const std::filesystem::path &fp);
+  std::optional<std::string> read(const Revision &rev);
+  // Bytes on disk and bytes of all revisions added up
+  std::pair<uint64_t, uint64_t> usage();
+
+private:
+  // Last, so it joins before the state it writes to is destroyed
+  std::jthread worker{};
+};
+
+struct DiffLine {
+  // ' ' unchanged, '-' removed, '+' added, '@' a run of hidden unchanged
+  // lines whose count is in `text`
+  char kind{' '};
+  std::string text{};
+};
+
+// Line diff from `from` to `to`, with unchanged runs longer than
+// 2 * `context` lines collapsed
+std::vector<DiffLine> diff_lines(std::string_view from, std::string_view to,
+                                 size_t context = 3);
+
+// Applies the line changes from `base` to `mine` and from `base` to
+// `theirs` together. Returns nothing if both change the same lines.
+std::optional<std::string> merge_lines(std::string_view base,
+                                       std::string_view mine,
+                                       std::string_view theirs);
+
+// Draws `lines` into the current ImGui window, added in green and removed
+// in red, submitting only the rows in view
+void render_diff(const std::vector<DiffLine> &lines);
@@ -0,0 +1,165 @@
+#include "search.hpp"
+#include <algorithm>
+#include <cstring>
+
+static unsigned char ascii_lower(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static unsigned char ascii_upper(unsigned char c) {
+  return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+static bool equals_folded(const char *a, const char *b, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (ascii_lower(a[i]) != ascii_lower(b[i]))
+      return false;
+  }
+  return true;
+}
+
+size_t find_next(std::string_view hay, std::string_view needle, size_t from,
+                 bool ignore_case) {
+  if (needle.empty() || from >= hay.size() ||
+      needle.size() > hay.size() - from)
+    return std::string_view::npos;
+
+  const char *base = hay.data();
+  // One past the last position a match can start at
+  const char *end = base + hay.size() - needle.size() + 1;
+  const char *rest = needle.data() + 1;
+  size_t rest_len = needle.size() - 1;
+  unsigned char lo = ascii_lower(needle[0]), up = ascii_upper(needle[0]);
+
+  if (!ignore_case || lo == up) {
+    unsigned char first = ignore_case ? lo : needle[0];
+    for (const char *p = base + from; p < end; ++p) {
+      p = static_cast<const char *>(std::memchr(p, first, end - p));
+      if (!p)
+        break;
+      bool eq = ignore_case ? equals_folded(p + 1, rest, rest_len)
+                            : std::memcmp(p + 1, rest, rest_len) == 0;
+      if (eq)
+        return p - base;
+    }
+    return std::string_view::npos;
+  }
+
+  // Case-insensitive with a letter first: look for both spellings in
+  // windows that double while they come up empty and start small again
+  // after each candidate. A call then costs time in proportion to how far
+  // it gets, even when one spelling never occurs.
+  const char *p = base + from;
+  size_t window{64};
+  while (p < end) {
+    const char *limit = p + std::min<size_t>(window, end - p);
+    auto *hit = static_cast<const char *>(std::memchr(p, lo, limit - p));
+    auto *hit_up = static_cast<const char *>(
+        std::memchr(p, up, (hit ? hit : limit) - p));
+    if (hit_up)
+      hit = hit_up;
+    if (!hit) {
+      p = limit;
+      window *= 2;
+      continue;
+    }
+    if (equals_folded(hit + 1, rest, rest_len))
+      return hit - base;
+    p = hit + 1;
+    window = 64;
+  }
+  return std::string_view::npos;
+}
+
+std::string replace_all(std::string_view hay, std::string_view needle,
+                        std::string_view with, bool ignore_case,
+                        size_t &cursor, size_t &count) {
+  std::vector<size_t> hits{};
+  for (size_t pos = find_next(hay, needle, 0, ignore_case);
+       pos != std::string_view::npos;
+       pos = find_next(hay, needle, pos + needle.size(), ignore_case)) {
+    hits.push_back(pos);
+  }
+  count = hits.size();
+
+  std::string out{};
+  out.reserve(hay.size() + hits.size() * with.size() -
+              std::min(hay.size(), hits.size() * needle.size()));
+  size_t last = 0, new_cursor = cursor;
+  for (size_t pos : hits) {
+    out.append(hay.substr(last, pos - last));
+    out.append(with);
+    last = pos + needle.size();
+    if (last <= cursor) {
+      new_cursor = new_cursor + with.size() - needle.size();
+    } else if (pos < cursor) {
+      new_cursor = out.size();
+    }
+  }
+  out.append(hay.substr(last));
+  cursor = new_cursor;
+  return out;
+}
+
+void Search::start(DocumentSnapshot snapshot) {
+  clear();
+  if (query.empty())
+    return;
+
+  running = true;
+  auto scan = [this, generation = generation, snapshot = std::move(snapshot),
+               query = query,
+               ignore_case = ignore_case](std::stop_token stop) {
+    // Chunk by chunk, so the text is never flattened and a stop is seen
+    // within a chunk. A match across a boundary is found in the last
+    // query.size() - 1 bytes before it joined to as many after it.
+    auto found = std::make_shared<std::vector<size_t>>();
+    size_t overlap = query.size() - 1;
+    std::string carry{}, seam{};
+    size_t offset{0};
+    // Matches do not overlap, so none starts before this
+    size_t next{0};
+    snapshot.text.for_each_chunk([&](std::string_view chunk) {
+      if (stop.stop_requested())
+        return;
+      // Finds the matches in `hay`, which starts at `base` in the text,
+      // that start before `limit`
+      auto collect = [&](std::string_view hay, size_t base, size_t limit) {
+        size_t from = next - std::min(next, base);
+        for (size_t pos = find_next(hay, query, from, ignore_case);
+             pos < limit;
+             pos = find_next(hay, query, pos + query.size(), ignore_case)) {
+          found->push_back(base + pos);
+          next = base + pos + query.size();
+        }
+      };
+      if (!carry.empty()) {
+        seam.assign(carry).append(chunk.substr(0, overlap));
+        collect(seam, offset - carry.size(), carry.size());
+      }
+      collect(chunk, offset, chunk.size());
+      offset += chunk.size();
+      carry.append(chunk.substr(chunk.size() - std::min(chunk.size(),
+                                                        overlap)));
+      carry.erase(0, carry.size() - std::min(carry.size(), overlap));
+    });
+    if (stop.stop_requested())
+      return;
+    tasks.post([this, generation, found = std::move(found)]() mutable {
+      if (generation != this->generation)
+        return;
+      matches = std::move(found);
+      running = false;
+    });
+  };
+  tasks.run(TaskPriority::Interactive, std::move(scan));
+}
+
+void Search::clear() {
+  // The scan may still be running; its results no longer match the
+  // generation and are dropped
+  tasks.stop();
+  ++generation;
+  matches = std::make_shared<std::vector<size_t>>();
+  running = false;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "document.hpp"
+#include "task_pool.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Finds the first occurrence of `needle` in `hay` at or after `from`.
+// Anchors on the first byte with memchr, so the scan runs at memchr speed.
+// `ignore_case` folds ASCII letters only.
+size_t find_next(std::string_view hay, std::string_view needle, size_t from,
+                 bool ignore_case);
+
+// Builds the replaced string in one pass. `cursor` is remapped to the same
+// logical position in the output.
+std::string replace_all(std::string_view hay, std::string_view needle,
+                        std::string_view with, bool ignore_case,
+                        size_t &cursor, size_t &count);
+
+using Matches = std::shared_ptr<const std::vector<size_t>>;
+
+// Collects match offsets on the task pool. Restarting stops the previous
+// scan without waiting for it, and results of a scan that was replaced
+// are dropped when they come back. Main thread only.
+class Search {
+  Matches matches{std::make_shared<std::vector<size_t>>()};
+  bool running{false};
+  // Bumped by every start and clear
+  size_t generation{0};
+  // Declared last so running scans finish before the state they post to
+  // is destroyed
+  TaskGroup tasks{};
+
+public:
+  std::string query{};
+  bool ignore_case{true};
+
+  void start(DocumentSnapshot snapshot);
+  void clear();
+  Matches get_matches() const { return matches; }
+  bool is_running() const { return running; }
+};
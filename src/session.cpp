@@ -0,0 +1,159 @@
+#include "session.hpp"
+#include "profiler.hpp"
+#include "utility.hpp"
+#include <bit>
+#include <fstream>
+#include <memory>
+
+static const char session_magic[4] = {'T', 'N', 'S', 'S'};
+static const uint32_t session_version = 1;
+
+static void write_path(std::string &out, const std::filesystem::path &fp) {
+  std::string s = fp.string();
+  write_varint(out, s.size());
+  out += s;
+}
+
+static bool read_path(std::string_view in, size_t &pos,
+                      std::filesystem::path &fp) {
+  uint64_t len;
+  if (!read_varint(in, pos, len) || len > in.size() - pos)
+    return false;
+  fp = std::string(in.substr(pos, len));
+  pos += len;
+  return true;
+}
+
+// Window coordinates can be negative on multi-monitor desktops
+static void write_int(std::string &out, int v) {
+  write_varint(out, static_cast<uint32_t>(v));
+}
+
+static bool read_int(std::string_view in, size_t &pos, int &v) {
+  uint64_t u;
+  if (!read_varint(in, pos, u) || u > UINT32_MAX)
+    return false;
+  v = static_cast<int>(static_cast<uint32_t>(u));
+  return true;
+}
+
+static std::string encode(const Session &session) {
+  std::string out{session_magic, sizeof(session_magic)};
+  write_varint(out, session_version);
+  write_int(out, session.window_x);
+  write_int(out, session.window_y);
+  write_int(out, session.window_w);
+  write_int(out, session.window_h);
+  write_varint(out, session.is_maximized);
+  write_varint(out, std::bit_cast<uint32_t>(session.editor_width));
+  write_path(out, session.explorer_root);
+  write_varint(out, session.active);
+  write_varint(out, session.tabs.size());
+  for (auto &tab : session.tabs) {
+    write_path(out, tab.fp);
+    write_varint(out, tab.cursor);
+    write_varint(out, tab.top_row);
+  }
+  return out;
+}
+
+static std::optional<Session> decode(std::string_view in) {
+  if (in.size() < sizeof(session_magic) ||
+      in.compare(0, sizeof(session_magic),
+                 std::string_view(session_magic, sizeof(session_magic))))
+    return std::nullopt;
+  size_t pos{sizeof(session_magic)};
+  uint64_t version, is_maximized, width, active, count;
+  if (!read_varint(in, pos, version) || version != session_version)
+    return std::nullopt;
+  Session session{};
+  if (!read_int(in, pos, session.window_x) ||
+      !read_int(in, pos, session.window_y) ||
+      !read_int(in, pos, session.window_w) ||
+      !read_int(in, pos, session.window_h) ||
+      !read_varint(in, pos, is_maximized) || !read_varint(in, pos, width) ||
+      width > UINT32_MAX || !read_path(in, pos, session.explorer_root) ||
+      !read_varint(in, pos, active) || !read_varint(in, pos, count))
+    return std::nullopt;
+  session.is_maximized = is_maximized != 0;
+  session.editor_width = std::bit_cast<float>(static_cast<uint32_t>(width));
+  session.active = active;
+  // Each tab takes at least three bytes
+  if (count > in.size() - pos)
+    return std::nullopt;
+  for (uint64_t i = 0; i < count; ++i) {
+    TabSession &tab = session.tabs.emplace_back();
+    uint64_t cursor, top_row;
+    if (!read_path(in, pos, tab.fp) || !read_varint(in, pos, cursor) ||
+        !read_varint(in, pos, top_row))
+      return std::nullopt;
+    tab.cursor = cursor;
+    tab.top_row = top_row;
+  }
+  return session;
+}
+
+static void write_session(const std::filesystem::path &path,
+                          std::string_view out) {
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+  {
+    std::ofstream fs(tmp, std::ios::binary | std::ios::trunc);
+    if (!fs)
+      return;
+    fs.write(out.data(), out.size());
+    if (!fs)
+      return;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+}
+
+SessionStore::SessionStore(const std::filesystem::path &root)
+    : path(root / ".take-notes-session") {}
+
+std::optional<Session> SessionStore::load() {
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(path, ec))
+    return std::nullopt;
+  std::string in{read_file_binary(path)};
+  auto session = decode(in);
+  // Restoring what is already on disk need not write it back
+  if (session)
+    written = std::move(in);
+  return session;
+}
+
+bool SessionStore::can_save() const {
+  return !is_writing && Profiler::now_ns() - written_ns >= write_interval_ns;
+}
+
+void SessionStore::save(const Session &session) {
+  if (!can_save())
+    return;
+  uint64_t now = Profiler::now_ns();
+  std::string out = encode(session);
+  if (out == written)
+    return;
+  written = out;
+  written_ns = now;
+  is_writing = true;
+  auto bytes = std::make_shared<std::string>(std::move(out));
+  tasks.run(TaskPriority::Background, [this, bytes](std::stop_token) {
+    write_session(path, *bytes);
+    tasks.post([this]() { is_writing = false; });
+  });
+}
+
+void SessionStore::flush(const Session &session) {
+  // Waits out a write in progress, which shares the temporary file. One
+  // that had not started yet is dropped, so this writes in its place.
+  bool was_writing = is_writing;
+  tasks.cancel();
+  is_writing = false;
+  std::string out = encode(session);
+  if (!was_writing && out == written)
+    return;
+  written = out;
+  write_session(path, out);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "task_pool.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct TabSession {
+  std::filesystem::path fp{};
+  size_t cursor{0};
+  // First row in view
+  size_t top_row{0};
+};
+
+// What the app showed when it was last closed
+struct Session {
+  std::vector<TabSession> tabs{};
+  size_t active{0};
+  std::filesystem::path explorer_root{};
+  // Share of the window the editor takes
+  float editor_width{0.8f};
+  int window_x{0}, window_y{0}, window_w{0}, window_h{0};
+  bool is_maximized{true};
+};
+
+// The session kept in `root/.take-notes-session`. Saves are encoded on the
+// main thread, which is cheap for a handful of tabs, and written on the
+// task pool only when the encoding changed, at most once per interval.
+// Callers save only after something in the session changed, and once
+// `can_save` allows it.
+class SessionStore {
+  std::filesystem::path path;
+  std::string written{};
+  uint64_t written_ns{0};
+  bool is_writing{false};
+
+public:
+  static constexpr uint64_t write_interval_ns = 1'000'000'000;
+
+  SessionStore(const std::filesystem::path &root);
+  std::optional<Session> load();
+  // False while a write runs or the last one is under an interval old
+  bool can_save() const;
+  void save(const Session &session);
+  // Writes on the calling thread, for exit
+  void flush(const Session &session);
+
+private:
+  // Last, so a running write finishes before the store goes away
+  TaskGroup tasks{};
+};
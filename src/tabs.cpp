@@ -0,0 +1,275 @@
+#include "tabs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+Tabs::Tabs(SDL_Window *window, SDL_Renderer *renderer, ImFont *plain,
+           ImFont *bold)
+    : window(window), renderer(renderer), plain(plain), bold(bold) {}
+
+Editor &Tabs::current() {
+  // Created on first use so it picks up settings made after construction
+  if (editors.empty())
+    add();
+  Editor &editor = *editors[active];
+  editor.width = width;
+  editor.top = height;
+  return editor;
+}
+
+void Tabs::set_fonts(ImFont *plain, ImFont *bold) {
+  this->plain = plain;
+  this->bold = bold;
+  // Each editor re-wraps once it sees the new space width
+  for (auto &editor : editors) {
+    editor->plain = plain;
+    editor->bold = bold;
+  }
+}
+
+void Tabs::save_session(Session &session) {
+  session.tabs.clear();
+  session.active = 0;
+  session.editor_width = width;
+  for (size_t i = 0; i < editors.size(); ++i) {
+    Editor &editor = *editors[i];
+    if (editor.get_filepath().empty())
+      continue;
+    if (i == active)
+      session.active = session.tabs.size();
+    session.tabs.push_back(
+        {editor.get_filepath(), editor.get_cursor(), editor.top_row()});
+  }
+}
+
+void Tabs::restore_session(const Session &session,
+                           std::vector<std::optional<std::string>> &&texts) {
+  std::optional<size_t> restored_active{};
+  for (size_t i = 0; i < session.tabs.size() && i < texts.size(); ++i) {
+    const TabSession &tab = session.tabs[i];
+    if (!texts[i])
+      continue;
+    open(tab.fp, std::move(*texts[i]));
+    current().restore_view(tab.cursor, tab.top_row);
+    if (i == session.active)
+      restored_active = active;
+  }
+  if (restored_active)
+    activate(*restored_active);
+}
+
+ImVec4 Tabs::get_bg_rect() { return current().get_bg_rect(); }
+
+Editor &Tabs::add() {
+  auto &editor = editors.emplace_back(
+      std::make_unique<Editor>(window, renderer, plain, bold));
+  editor->font_size = zoomed_size();
+  editor->example_file = example_file;
+  editor->on_save(save_evt);
+  last_used.push_back(frame);
+  return *editor;
+}
+
+void Tabs::activate(size_t idx) {
+  active = idx;
+  select_active = true;
+  is_session_dirty = true;
+  editors[active]->update_title();
+}
+
+void Tabs::open(std::filesystem::path fp, std::string &&text,
+                std::optional<size_t> line) {
+  auto go_to = [&]() {
+    if (line)
+      current().go_to_line(*line);
+  };
+  for (size_t i = 0; i < editors.size(); ++i) {
+    if (editors[i]->get_filepath() == fp) {
+      activate(i);
+      go_to();
+      return;
+    }
+  }
+  // Reuse the untouched tab the app starts with
+  if (current().is_blank()) {
+    current().set_text(fp, std::move(text));
+    activate(active);
+    go_to();
+    return;
+  }
+  add().set_text(fp, std::move(text));
+  activate(editors.size() - 1);
+  go_to();
+}
+
+void Tabs::close(size_t idx) {
+  editors.erase(editors.begin() + idx);
+  last_used.erase(last_used.begin() + idx);
+  if (active >= idx && active > 0)
+    --active;
+  current();
+  activate(active);
+}
+
+void Tabs::event(const SDL_Event &event) {
+  if (event.type == SDL_EVENT_MOUSE_WHEEL &&
+      SDL_GetModState() & SDL_KMOD_CTRL) {
+    if (current().is_focused)
+      zoom_by(event.wheel.y);
+    return;
+  }
+  current().event(event);
+}
+
+// Whole pixels, so each size zoomed through is one set of baked glyphs
+float Tabs::zoomed_size() {
+  return std::clamp(std::round(font_size * std::pow(1.1f, zoom)),
+                    min_font_size, max_font_size);
+}
+
+void Tabs::zoom_by(float notches) {
+  float steps = std::log(1.1f);
+  zoom = std::clamp(zoom + notches, std::log(min_font_size / font_size) / steps,
+                    std::log(max_font_size / font_size) / steps);
+  float size = zoomed_size();
+  for (auto &editor : editors)
+    editor->font_size = size;
+  zoom_frame = frame;
+  is_font_cache_compact = false;
+}
+
+void Tabs::on_save(Tabs::save_event_fn fn) {
+  save_evt = fn;
+  for (auto &editor : editors)
+    editor->on_save(fn);
+}
+
+bool Tabs::is_save_needed() {
+  for (auto &editor : editors) {
+    if (!editor->is_blank() && editor->is_save_needed())
+      return true;
+  }
+  return false;
+}
+
+void Tabs::trim() {
+  idle.clear();
+  size_t total{0};
+  for (size_t i = 0; i < editors.size(); ++i) {
+    if (i == active)
+      continue;
+    size_t bytes = editors[i]->texture_bytes();
+    if (bytes == 0)
+      continue;
+    total += bytes;
+    idle.emplace_back(last_used[i], i);
+  }
+  std::sort(idle.begin(), idle.end());
+  for (auto &[_, i] : idle) {
+    if (total <= texture_budget)
+      break;
+    total -= editors[i]->texture_bytes();
+    editors[i]->trim();
+  }
+}
+
+void Tabs::watch_files() {
+  // The watch list is only rebuilt when a tab's file changed
+  size_t n{0};
+  bool is_same{true};
+  for (auto &editor : editors) {
+    const std::filesystem::path &fp = editor->get_filepath();
+    if (fp.empty())
+      continue;
+    is_same = is_same && n < watched.size() && watched[n] == fp;
+    ++n;
+  }
+  if (!is_same || n != watched.size()) {
+    watched.clear();
+    for (auto &editor : editors) {
+      if (!editor->get_filepath().empty())
+        watched.push_back(editor->get_filepath());
+    }
+    watcher.watch(watched);
+  }
+  for (auto &fp : watcher.poll()) {
+    for (auto &editor : editors) {
+      if (editor->get_filepath() == fp)
+        editor->check_disk();
+    }
+  }
+}
+
+void Tabs::render() {
+  current();
+  watch_files();
+  ++frame;
+  last_used[active] = frame;
+
+  int winw, winh;
+  SDL_GetWindowSize(window, &winw, &winh);
+  ImGui::SetNextWindowPos({0, 0});
+  ImGui::SetNextWindowSize({winw * width, height});
+  ImGui::Begin("Tabs", nullptr,
+               ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+                   ImGuiWindowFlags_NoScrollbar);
+  if (ImGui::BeginTabBar("Documents")) {
+    for (size_t i = 0; i < editors.size(); ++i) {
+      Editor &editor = *editors[i];
+      ImGuiTabItemFlags flags{ImGuiTabItemFlags_None};
+      if (editor.is_unsaved())
+        flags |= ImGuiTabItemFlags_UnsavedDocument;
+      if (select_active && i == active)
+        flags |= ImGuiTabItemFlags_SetSelected;
+      bool open{true};
+      if (ImGui::BeginTabItem(editor.get_tab_label().c_str(), &open, flags)) {
+        if (!select_active && i != active)
+          activate(i);
+        ImGui::EndTabItem();
+      }
+      if (!open) {
+        closing = i;
+        request_close = true;
+      }
+    }
+    ImGui::EndTabBar();
+  }
+  select_active = false;
+  ImGui::End();
+
+  if (request_close) {
+    request_close = false;
+    if (!editors[closing]->is_blank() && editors[closing]->is_save_needed())
+      ImGui::OpenPopup("Notice##Close");
+    else
+      close(closing);
+  }
+
+  if (ImGui::BeginPopupModal("Notice##Close", NULL,
+                             ImGuiWindowFlags_AlwaysAutoResize)) {
+    ImGui::TextWrapped("%s", "You haven't saved your file yet. Close it?");
+    if (ImGui::Button("Close", ImVec2(80, 0))) {
+      close(closing);
+      ImGui::CloseCurrentPopup();
+    }
+    if (ImGui::Button("Stay", ImVec2(80, 0))) {
+      ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
+  }
+
+  current().render();
+  for (auto &editor : editors) {
+    if (std::exchange(editor->is_view_moved, false))
+      is_session_dirty = true;
+  }
+
+  trim();
+  // Glyphs are rasterized on first use at each size drawn. Once zooming
+  // has settled for a second or so, sizes no longer drawn are dropped
+  // from the atlas.
+  if (!is_font_cache_compact && frame - zoom_frame > 60) {
+    ImGui::GetIO().Fonts->CompactCache();
+    is_font_cache_compact = true;
+  }
+}
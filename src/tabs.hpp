@@ -0,0 +1,76 @@
+#pragma once
+#include "editor.hpp"
+#include "file_watch.hpp"
+#include "session.hpp"
+#include <SDL3/SDL.h>
+#include <filesystem>
+#include <imgui.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Open documents, one Editor each. Only the active one renders and gets
+// events; the others keep their buffer and tokens but give up their image
+// textures once they exceed `texture_budget`, least recently used first.
+// Ctrl+wheel zooms the text of every tab. Open files are watched, and a
+// tab whose file another program changes checks it.
+class Tabs {
+  using save_event_fn = std::function<void(std::filesystem::path)>;
+  std::vector<std::unique_ptr<Editor>> editors{};
+  std::vector<size_t> last_used{};
+  std::vector<std::pair<size_t, size_t>> idle{};
+  size_t active{0};
+  size_t frame{0};
+  bool select_active{false};
+  size_t closing{0};
+  bool request_close{false};
+  save_event_fn save_evt = 0;
+  // Ctrl+wheel notches, each scaling the text by 10%
+  float zoom{0.0f};
+  size_t zoom_frame{0};
+  bool is_font_cache_compact{true};
+  SDL_Window *window;
+  SDL_Renderer *renderer;
+  ImFont *plain, *bold;
+  FileWatcher watcher{};
+  std::vector<std::filesystem::path> watched{};
+
+  Editor &add();
+  void activate(size_t idx);
+  void close(size_t idx);
+  void trim();
+  float zoomed_size();
+  void zoom_by(float notches);
+  void watch_files();
+
+public:
+  float width{0.8f}, height{28.0f}, font_size{18.0f};
+  float min_font_size{8.0f}, max_font_size{72.0f};
+  size_t texture_budget{128ull << 20};
+  // Set when a tab opens, closes or is switched to, or an editor's view
+  // moves; the session is saved only then
+  bool is_session_dirty{false};
+  std::filesystem::path example_file{};
+
+  Tabs(SDL_Window *window, SDL_Renderer *renderer, ImFont *plain,
+       ImFont *bold);
+  Editor &current();
+  // Switches every tab to fonts loaded after startup
+  void set_fonts(ImFont *plain, ImFont *bold);
+  // Records the tabs that have a file, with their cursor and scroll
+  void save_session(Session &session);
+  // Opens the session's tabs; `texts` holds each one's contents, or
+  // nothing if it could not be read
+  void restore_session(const Session &session,
+                       std::vector<std::optional<std::string>> &&texts);
+  ImVec4 get_bg_rect();
+  // Opens `fp` in a tab, or switches to it if already open, at `line` if
+  // given
+  void open(std::filesystem::path fp, std::string &&text,
+            std::optional<size_t> line = std::nullopt);
+  void event(const SDL_Event &event);
+  void render();
+  void on_save(save_event_fn event);
+  bool is_save_needed();
+};
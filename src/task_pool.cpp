@@ -0,0 +1,155 @@
+#include "task_pool.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+
+TaskPool &TaskPool::get() {
+  // One thread is left for the main loop
+  static TaskPool pool{std::max(2u, std::thread::hardware_concurrency()) - 1};
+  return pool;
+}
+
+TaskPool::TaskPool(size_t threads) {
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; ++i)
+    queues.push_back(std::make_unique<Queue>());
+  for (size_t i = 0; i < threads; ++i)
+    this->threads.emplace_back(
+        [this, i](std::stop_token stop) { work(i, stop); });
+}
+
+void TaskPool::submit(TaskPriority priority, Task task) {
+  // Workers keep what they spawn; other threads spread work round-robin
+  size_t i = worker_pool == this ? worker_index
+                                 : next_queue++ % queues.size();
+  {
+    Queue &queue = *queues[i];
+    std::lock_guard lock{queue.mtx};
+    queue.tasks[static_cast<size_t>(priority)].push_back(std::move(task));
+  }
+  ++queued;
+  // Taking the lock orders this with a worker checking `queued` before it
+  // sleeps, so the wakeup cannot be missed
+  { std::lock_guard lock{sleep_mtx}; }
+  sleep_cv.notify_one();
+}
+
+bool TaskPool::pop(size_t self, Task &task) {
+  for (size_t priority = 0; priority < 2; ++priority) {
+    // Newest own task first while it is still warm in cache, oldest when
+    // stealing so the victim keeps its recent work
+    for (size_t n = 0; n < queues.size(); ++n) {
+      Queue &queue = *queues[(self + n) % queues.size()];
+      std::lock_guard lock{queue.mtx};
+      std::deque<Task> &tasks = queue.tasks[priority];
+      if (tasks.empty())
+        continue;
+      if (n == 0) {
+        task = std::move(tasks.back());
+        tasks.pop_back();
+      } else {
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      --queued;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskPool::work(size_t self, std::stop_token stop) {
+  worker_pool = this;
+  worker_index = self;
+  Task task{};
+  while (!stop.stop_requested()) {
+    if (pop(self, task)) {
+      // A task that throws is reported and dropped; escaping the worker
+      // would end the app
+      try {
+        task();
+      } catch (const std::exception &e) {
+        std::fprintf(stderr, "Background task failed: %s\n", e.what());
+      } catch (...) {
+        std::fprintf(stderr, "Background task failed\n");
+      }
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock lock{sleep_mtx};
+    sleep_cv.wait(lock, stop, [&]() { return queued > 0; });
+  }
+}
+
+void TaskPool::post(Task task) {
+  std::lock_guard lock{done_mtx};
+  done.push_back(std::move(task));
+}
+
+size_t TaskPool::drain() {
+  {
+    std::lock_guard lock{done_mtx};
+    // Tasks posted while these run wait for the next frame
+    draining.swap(done);
+  }
+  for (Task &task : draining)
+    task();
+  size_t count = draining.size();
+  draining.clear();
+  return count;
+}
+
+TaskGroup::~TaskGroup() {
+  cancel();
+  state->alive = false;
+}
+
+void TaskGroup::run(TaskPriority priority,
+                    std::function<void(std::stop_token)> task) {
+  std::stop_token stop{};
+  {
+    std::lock_guard lock{state->mtx};
+    stop = state->stop.get_token();
+  }
+  TaskPool::get().submit(
+      priority, [state = state, stop, task = std::move(task)]() {
+        {
+          std::lock_guard lock{state->mtx};
+          if (stop.stop_requested())
+            return;
+          ++state->running;
+        }
+        // Counted out even if the task throws, or cancel() would wait on
+        // it forever
+        struct Finish {
+          State &state;
+          ~Finish() {
+            std::lock_guard lock{state.mtx};
+            --state.running;
+            state.cv.notify_all();
+          }
+        } finish{*state};
+        task(stop);
+      });
+}
+
+void TaskGroup::post(std::function<void()> task) {
+  TaskPool::get().post([state = state, task = std::move(task)]() {
+    if (state->alive)
+      task();
+  });
+}
+
+void TaskGroup::cancel() {
+  std::unique_lock lock{state->mtx};
+  state->stop.request_stop();
+  state->cv.wait(lock, [&]() { return state->running == 0; });
+  // Tasks started from now on get a fresh token
+  state->stop = std::stop_source{};
+}
+
+void TaskGroup::stop() {
+  std::lock_guard lock{state->mtx};
+  state->stop.request_stop();
+  state->stop = std::stop_source{};
+}
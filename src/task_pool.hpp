@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+enum class TaskPriority { Interactive, Background };
+
+// Worker threads shared by every subsystem. Each worker owns a queue per
+// priority and steals from the others when its own run dry; interactive
+// work anywhere runs before background work. Results come back to the
+// main thread through `post`, run by `drain` once per frame.
+class TaskPool {
+  using Task = std::function<void()>;
+  struct Queue {
+    std::mutex mtx{};
+    std::deque<Task> tasks[2]{};
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues{};
+  std::atomic<size_t> queued{0};
+  std::atomic<size_t> next_queue{0};
+  std::mutex sleep_mtx{};
+  std::condition_variable_any sleep_cv{};
+  std::mutex done_mtx{};
+  std::vector<Task> done{};
+  std::vector<Task> draining{};
+
+  static inline thread_local const TaskPool *worker_pool{nullptr};
+  static inline thread_local size_t worker_index{0};
+
+  bool pop(size_t self, Task &task);
+  void work(size_t self, std::stop_token stop);
+
+public:
+  static TaskPool &get();
+
+  TaskPool(size_t threads);
+  TaskPool(const TaskPool &) = delete;
+  TaskPool &operator=(const TaskPool &) = delete;
+  size_t size() { return queues.size(); }
+  void submit(TaskPriority priority, Task task);
+  // Queues `task` to run on the main thread at the next drain
+  void post(Task task);
+  // Runs posted tasks on the calling thread, returns how many ran
+  size_t drain();
+
+private:
+  // Last, so workers join before the queues they read are destroyed
+  std::vector<std::jthread> threads{};
+};
+
+// Tasks that touch one owner's state. cancel() and the destructor request
+// a stop, skip tasks that have not started and wait for running ones, so
+// the owner can be destroyed safely. stop() does the same without waiting,
+// for tasks that only hand results back through post(). Completions posted
+// through a group are dropped once it is gone.
+class TaskGroup {
+  struct State {
+    std::mutex mtx{};
+    std::condition_variable cv{};
+    size_t running{0};
+    std::stop_source stop{};
+    // Only touched on the main thread
+    bool alive{true};
+  };
+  std::shared_ptr<State> state{std::make_shared<State>()};
+
+public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+  ~TaskGroup();
+  void run(TaskPriority priority, std::function<void(std::stop_token)> task);
+  void post(std::function<void()> task);
+  void cancel();
+  void stop();
+};
@@ -0,0 +1,82 @@
+#include "text_stats.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+static bool is_space(char c) { return static_cast<unsigned char>(c) <= ' '; }
+
+TextCounts count_text(std::string_view text, char before) {
+  TextCounts counts{};
+  const char *data = text.data();
+  size_t n = text.size(), i{0};
+  if constexpr (std::endian::native == std::endian::little) {
+    constexpr uint64_t ones = 0x0101010101010101, highs = ones * 0x80;
+    // Each mask holds the high bit of the bytes it matches. Matches are
+    // summed per byte lane, and the lanes added up before any can reach
+    // 256.
+    uint64_t prev_space = is_space(before) ? 0x80 : 0;
+    auto lanes = [](uint64_t sums) {
+      constexpr uint64_t mask = 0x00FF00FF00FF00FF;
+      uint64_t pairs = (sums & mask) + (sums >> 8 & mask);
+      return (pairs * 0x0001000100010001) >> 48;
+    };
+    while (i + 8 <= n) {
+      uint64_t newlines{0}, continuations{0}, starts{0};
+      size_t start = i;
+      size_t end = std::min(n - (n - i) % 8, i + 255 * 8);
+      for (; i < end; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, data + i, 8);
+        uint64_t x = w ^ (ones * '\n');
+        newlines += ~(((x & ~highs) + ~highs) | x | ~highs) >> 7;
+        // 10xxxxxx
+        continuations += (w & ~(w << 1) & highs) >> 7;
+        uint64_t space = ~((w | highs) - ones * 0x21) & ~w & highs;
+        starts += (~space & highs & (space << 8 | prev_space)) >> 7;
+        prev_space = space >> 56;
+      }
+      counts.newlines += lanes(newlines);
+      counts.codepoints += (i - start) - lanes(continuations);
+      counts.words += lanes(starts);
+    }
+  }
+  bool was_space = i > 0 ? is_space(data[i - 1]) : is_space(before);
+  for (; i < n; ++i) {
+    char c = data[i];
+    counts.newlines += c == '\n';
+    counts.codepoints += (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+    counts.words += was_space && !is_space(c);
+    was_space = is_space(c);
+  }
+  return counts;
+}
+
+void TextStats::insert(std::string_view text, size_t pos,
+                       std::string_view str) {
+  if (str.empty())
+    return;
+  char before = pos > 0 ? text[pos - 1] : ' ';
+  TextCounts added = count_text(str, before);
+  counts.words += added.words;
+  counts.codepoints += added.codepoints;
+  counts.newlines += added.newlines;
+  // A word after the insertion may now be joined to it, or split from
+  // what was before it
+  if (pos < text.size() && !is_space(text[pos]))
+    counts.words += is_space(str.back()) - is_space(before);
+}
+
+void TextStats::erase(std::string_view text, size_t pos, size_t len) {
+  std::string_view removed = text.substr(pos, len);
+  if (removed.empty())
+    return;
+  char before = pos > 0 ? text[pos - 1] : ' ';
+  TextCounts erased = count_text(removed, before);
+  counts.words -= erased.words;
+  counts.codepoints -= erased.codepoints;
+  counts.newlines -= erased.newlines;
+  size_t after = pos + removed.size();
+  if (after < text.size() && !is_space(text[after]))
+    counts.words += is_space(before) - is_space(removed.back());
+}
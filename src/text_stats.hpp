@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+// Counts of a run of text. Words are runs of bytes other than spaces and
+// control characters, so markup markers standing alone count as words.
+struct TextCounts {
+  size_t words{0}, codepoints{0}, newlines{0};
+};
+
+// Counts `text` as if it followed the byte `before`. Eight bytes are
+// counted at a time, so opening or pasting a large note stays cheap.
+TextCounts count_text(std::string_view text, char before = ' ');
+
+// Whole-document counts kept in step with edits. Each edit costs the
+// length of the inserted or erased text, whatever the document's size.
+class TextStats {
+  TextCounts counts{};
+
+public:
+  // Called with the text as it is before the edit
+  void insert(std::string_view text, size_t pos, std::string_view str);
+  void erase(std::string_view text, size_t pos, size_t len);
+  void assign(std::string_view text) { counts = count_text(text); }
+  const TextCounts &get() const { return counts; }
+};
@@ -1,10 +1,13 @@
 #include "utility.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <ios>
 
 // TODO: Swap for proper utf8
-size_t utf8_next_len(const std::string &s, size_t pos) {
+size_t utf8_next_len(std::string_view s, size_t pos) {
   if (pos >= s.size())
     return 0;
   unsigned char c = (unsigned char)s[pos];
@@ -19,7 +22,7 @@ size_t utf8_next_len(const std::string &s, size_t pos) {
   return 1;
 }
 
-size_t utf8_prev_len(const std::string &s, size_t pos) {
+size_t utf8_prev_len(std::string_view s, size_t pos) {
   if (pos == 0)
     return 0;
   size_t i = pos;
@@ -32,25 +35,141 @@ size_t utf8_prev_len(const std::string &s, size_t pos) {
   return pos;
 }
 
-std::string read_file_binary(const std::filesystem::path &filepath) {
-  std::ifstream fs(filepath, std::ios::in | std::ios::binary);
-  fs.seekg(0, std::ios::end);
-  size_t sz = fs.tellg();
-  fs.seekg(0, std::ios::beg);
+size_t utf8_valid_len(std::string_view s, size_t pos) {
+  auto byte = [&](size_t i) -> unsigned char {
+    return pos + i < s.size() ? s[pos + i] : 0;
+  };
+  auto is_cont = [&](size_t i) { return (byte(i) & 0xC0) == 0x80; };
+  if (pos >= s.size())
+    return 0;
+  unsigned char c = byte(0);
+  if (c < 0x80)
+    return 1;
+  if (c >= 0xC2 && c <= 0xDF)
+    return is_cont(1) ? 2 : 0;
+  // The second byte's range rules out overlong forms, surrogates and code
+  // points past U+10FFFF
+  unsigned char lo{0x80}, hi{0xBF};
+  if (c == 0xE0 || c == 0xF0)
+    lo = c == 0xE0 ? 0xA0 : 0x90;
+  else if (c == 0xED)
+    hi = 0x9F;
+  else if (c == 0xF4)
+    hi = 0x8F;
+  else if (c < 0xE1 || c > 0xF3)
+    return 0;
+  if (byte(1) < lo || byte(1) > hi || !is_cont(2))
+    return 0;
+  if (c < 0xF0)
+    return 3;
+  return is_cont(3) ? 4 : 0;
+}
+
+std::string normalize_text(std::string_view in,
+                           std::atomic<size_t> *progress) {
+  constexpr uint64_t ones = 0x0101010101010101, highs = ones * 0x80;
+  constexpr size_t block = size_t(1) << 20;
+  std::string out{};
+  out.reserve(in.size());
+  size_t n = in.size(), i{0}, copied{0};
+  auto replace = [&](size_t len, std::string_view with) {
+    out.append(in.substr(copied, i - copied));
+    out.append(with);
+    i += len;
+    copied = i;
+  };
+  while (i < n) {
+    size_t limit = std::min(n, i + block);
+    while (i < limit) {
+      // Runs of ASCII without a CR are kept, eight bytes at a time
+      if constexpr (std::endian::native == std::endian::little) {
+        if (i + 8 <= n) {
+          uint64_t w;
+          std::memcpy(&w, in.data() + i, 8);
+          uint64_t x = w ^ (ones * '\r');
+          uint64_t cr = ~(((x & ~highs) + ~highs) | x | ~highs);
+          if (((w & highs) | cr) == 0) {
+            i += 8;
+            continue;
+          }
+        }
+      }
+      unsigned char c = in[i];
+      if (c == '\r') {
+        replace(i + 1 < n && in[i + 1] == '\n' ? 2 : 1, "\n");
+      } else if (size_t len = utf8_valid_len(in, i)) {
+        i += len;
+      } else {
+        replace(1, "\xEF\xBF\xBD");
+      }
+    }
+    if (progress)
+      progress->store(std::min(i, n), std::memory_order_relaxed);
+  }
+  out.append(in.substr(copied));
+  return out;
+}
+
+void write_varint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out += static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  out += static_cast<char>(v);
+}
+
+bool read_varint(std::string_view in, size_t &pos, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+    unsigned char c = in[pos++];
+    v |= static_cast<uint64_t>(c & 0x7F) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+  return false;
+}
+
+uint64_t hash_bytes(std::string_view s) {
+  uint64_t h{0xcbf29ce484222325};
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+static std::string read_file(const std::filesystem::path &filepath,
+                             std::ios::openmode mode, std::error_code &ec) {
+  uintmax_t sz = std::filesystem::file_size(filepath, ec);
+  if (ec)
+    return {};
+  std::ifstream fs(filepath, mode);
+  if (!fs) {
+    ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+  }
   std::string contents{};
   contents.resize(sz);
   fs.read(contents.data(), sz);
+  // The file may have shrunk since it was sized, and text mode on Windows
+  // reads CRLF as one byte
+  contents.resize(fs.gcount());
   return contents;
 }
 
-std::string read_file_text(const std::filesystem::path &filepath) {
-  std::ifstream fs(filepath);
-  fs.seekg(0, std::ios::end);
-  size_t sz = fs.tellg();
-  fs.seekg(0, std::ios::beg);
-  std::string contents{};
-  contents.resize(sz);
-  fs.read(contents.data(), sz);
+std::string read_file_binary(const std::filesystem::path &filepath,
+                             std::error_code &ec) {
+  return read_file(filepath, std::ios::in | std::ios::binary, ec);
+}
+
+std::string read_file_binary(const std::filesystem::path &filepath) {
+  std::error_code ec;
+  return read_file_binary(filepath, ec);
+}
+
+std::string read_file_text(const std::filesystem::path &filepath,
+                           std::error_code &ec) {
+  std::string contents{read_file(filepath, std::ios::in, ec)};
   // For Windows
   for (std::string::size_type pos = 0;
        (pos = contents.find("\r\n", pos)) != std::string::npos; pos += 1) {
@@ -58,3 +177,8 @@ std::string read_file_text(const std::filesystem::path &filepath) {
   }
   return contents;
 }
+
+std::string read_file_text(const std::filesystem::path &filepath) {
+  std::error_code ec;
+  return read_file_text(filepath, ec);
+}
@@ -1,11 +1,37 @@
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <string>
+#include <string_view>
 
-size_t utf8_next_len(const std::string &s, size_t pos);
+size_t utf8_next_len(std::string_view s, size_t pos);
 
-size_t utf8_prev_len(const std::string &s, size_t pos);
+size_t utf8_prev_len(std::string_view s, size_t pos);
 
+// Length of the well-formed UTF-8 sequence at `pos`, or 0 if it is not one
+size_t utf8_valid_len(std::string_view s, size_t pos);
+
+// Converts CRLF and lone CR line endings to LF and replaces ill-formed
+// UTF-8 with U+FFFD, in one pass. `progress`, if given, follows the input
+// bytes done.
+std::string normalize_text(std::string_view in,
+                           std::atomic<size_t> *progress = nullptr);
+
+// LEB128, as used by the on-disk index formats
+void write_varint(std::string &out, uint64_t v);
+bool read_varint(std::string_view in, size_t &pos, uint64_t &v);
+
+// 64-bit FNV-1a, for content addressing
+uint64_t hash_bytes(std::string_view s);
+
+// These set `ec` and return nothing when the file cannot be read, e.g.
+// because it was deleted after being listed. Without `ec`, such a file
+// reads as empty.
+std::string read_file_binary(const std::filesystem::path &filepath,
+                             std::error_code &ec);
 std::string read_file_binary(const std::filesystem::path &filepath);
 
+std::string read_file_text(const std::filesystem::path &filepath,
+                           std::error_code &ec);
 std::string read_file_text(const std::filesystem::path &filepath);
\ No newline at end of file